@@ -0,0 +1,109 @@
+#include "bench.h"
+#include "networking.h"
+#include "log.h"
+#include <poll.h>
+#include <chrono>
+
+//Messages timed per endpoint unless --messages says otherwise, and how many go out first to warm everything up.
+#define BENCH_MESSAGES 10000
+#define BENCH_WARMUP 100
+//Longest we wait on the server for anything before giving up on an endpoint.
+#define BENCH_TIMEOUT 5000
+
+//Connects a blocking socket, giving up after BENCH_TIMEOUT. Returns false with errno set if it can't.
+static bool Connect( Socket& socket, int port, const char* address ){
+    int result = socket.connect( port, address );
+    if( result == RESULT_SLEEP ){
+        pollfd writable = { socket.sockfd, POLLOUT, 0 };
+        poll( &writable, 1, BENCH_TIMEOUT );
+        result = socket.connected();
+        if( result == RESULT_SLEEP ){
+            errno = ETIMEDOUT;
+            result = RESULT_ERROR;
+        }
+    }
+    if( result != RESULT_OK ) return false;
+    //Blocking from here on, there's nothing else to do while we wait. Receiving times out instead of hanging.
+    socket.setNonBlocking( false );
+    timeval timeout = { BENCH_TIMEOUT / 1000, 0 };
+    setsockopt( socket.sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+    return true;
+}
+
+//Receives until a packet of type comes from name. Returns false if the connection broke or the server took too long.
+//Servers speaking wire version 3 only send the name with the first packet, member is it's number from then on.
+static bool WaitFor( Socket& socket, int type, const std::string& name, uint32_t& member ){
+    PacketView packet;
+    while( true ){
+        //Timed out, hung up or broke.
+        if( socket.receive( packet ) != RESULT_OK ) return false;
+        if( packet.header.packetType != type ) continue;
+        if( packet.sender == name ) member = packet.header.member;
+        if( packet.sender == name || ( member && packet.sender.empty() && packet.header.member == member ) ) return true;
+    }
+}
+
+//Times messages over one endpoint and prints how it went. Returns false if it couldn't.
+static bool Benchmark( const std::string& endpoint, int port, int messages, int turn ){
+    std::string address = endpoint;
+    SplitEndpoint( address, port );
+    Socket socket( -1, CLIENT );
+    if( !Connect( socket, port, address.c_str() ) ){
+        printf( "%-28s can't connect : %s\n", endpoint.c_str(), strerror(errno) );
+        return false;
+    }
+    //A room of our own, so nobody else's messages get in the way.
+    std::string name = "bench-" + std::to_string( getpid() ) + "-" + std::to_string( turn );
+    socket.send( PacketView( CONNECT_PACKET, std::to_string(WIRE_VERSION) + " " + name, name ) );
+    socket.flush();
+    //We're in once our own hello comes back.
+    uint32_t member = 0;
+    if( !WaitFor( socket, CONNECT_PACKET, name, member ) ){
+        printf( "%-28s didn't let us in\n", endpoint.c_str() );
+        return false;
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve( messages );
+    for( int i = 0; i < BENCH_WARMUP + messages; i++ ){
+        auto start = std::chrono::steady_clock::now();
+        socket.send( PacketView( MESSAGE_PACKET, "ping", name ) );
+        socket.flush();
+        if( !WaitFor( socket, MESSAGE_PACKET, name, member ) ){
+            printf( "%-28s stopped answering after %d messages\n", endpoint.c_str(), i );
+            return false;
+        }
+        std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start;
+        if( i >= BENCH_WARMUP ) latencies.push_back( took.count() );
+    }
+    std::sort( latencies.begin(), latencies.end() );
+    double total = 0;
+    for( double latency : latencies ) total += latency;
+    printf( "%-28s %9.1f %9.1f %9.1f %9.1f %9.1f\n", endpoint.c_str(), latencies.front(), latencies[ latencies.size() / 2 ],
+            latencies[ latencies.size() * 99 / 100 ], latencies.back(), total / latencies.size() );
+    return true;
+}
+
+int RunBenchmark( int argc, char* argv[] ){
+    std::vector< std::string > endpoints;
+    int port = DEFAULT_PORT;
+    int messages = BENCH_MESSAGES;
+    for( int i = 1; i < argc; i++ ){
+        //Endpoint to time, written like --listen's. Can be given many times.
+        if( !strcmp( argv[i], "--bench" ) && i + 1 < argc ) endpoints.push_back( argv[++i] );
+        //Port for the endpoints that don't have one.
+        else if( !strcmp( argv[i], "--port" ) && i + 1 < argc ) port = atoi( argv[++i] );
+        //Messages timed per endpoint.
+        else if( !strcmp( argv[i], "--messages" ) && i + 1 < argc ) messages = std::max( 1, atoi( argv[++i] ) );
+    }
+    if( endpoints.empty() ){
+        printf( "--bench needs an endpoint, like --bench unix:@tchat --bench 127.0.0.1 --bench [::1]\n" );
+        return 1;
+    }
+
+    printf( "%d messages per endpoint, round trip through the server in microseconds.\n", messages );
+    printf( "%-28s %9s %9s %9s %9s %9s\n", "endpoint", "min", "median", "p99", "max", "mean" );
+    bool allGood = true;
+    for( size_t i = 0; i < endpoints.size(); i++ ) allGood = Benchmark( endpoints[i], port, messages, i ) && allGood;
+    return allGood ? 0 : 1;
+}
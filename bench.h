@@ -0,0 +1,6 @@
+//Loopback latency benchmark (--bench), for comparing transports on one box. It joins a running server over every
+//endpoint it's given, one at a time, and times how long each message takes to come back as a broadcast.
+#pragma once
+
+//Runs the benchmark the command-line arguments ask for, prints the results and returns the exit code.
+int RunBenchmark( int argc, char* argv[] );
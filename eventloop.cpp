@@ -0,0 +1,44 @@
+#include "eventloop.h"
+#include "log.h"
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+EventLoop::EventLoop(){
+    //Close on exec, nothing else is interesting.
+    epollfd = epoll_create1( EPOLL_CLOEXEC );
+    //We really can't do anything without it.
+    if( epollfd == -1 ) Fatal( "Couldn't create epoll instance : %s", strerror(errno) );
+}
+
+EventLoop::~EventLoop(){
+    if( epollfd >= 0 ) close(epollfd);
+}
+
+int EventLoop::add( int fd, uint32_t events, void* data ){
+    epoll_event event = {0};
+    event.events = events;
+    //Pointer to the object owning fd.
+    event.data.ptr = data;
+    return epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+}
+
+int EventLoop::modify( int fd, uint32_t events, void* data ){
+    epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = data;
+    return epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event );
+}
+
+int EventLoop::remove( int fd ){
+    //Kernels before 2.6.9 wanted a non-null event even though it's ignored.
+    epoll_event event = {0};
+    return epoll_ctl( epollfd, EPOLL_CTL_DEL, fd, &event );
+}
+
+int EventLoop::wait( int timeout ){
+    int ready = epoll_wait( epollfd, events, MAX_EVENTS, timeout );
+    //Getting interrupted by a signal isn't really an error, there's just nothing to do.
+    if( ready == -1 && errno == EINTR ) return 0;
+    return ready;
+}
@@ -0,0 +1,35 @@
+//Wraps epoll so we only ever hear about the sockets that actually have something going on.
+//Every file descriptor is registered with a pointer to whatever object owns it, so when an event
+//comes back we can go straight to that object instead of looking it up.
+#pragma once
+#include <sys/epoll.h>
+#include <cstdint>
+
+//Maximum amount of events handled per wait().
+#define MAX_EVENTS 256
+
+class EventLoop{
+    public:
+        //Creates the epoll instance.
+        EventLoop();
+        //Closes the epoll instance.
+        ~EventLoop();
+        //Every event loop owns it's own epoll file descriptor, so no copying.
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        //Starts watching fd for events, data is handed back with every event on it.
+        int add( int fd, uint32_t events, void* data );
+        //Changes the events watched on fd.
+        int modify( int fd, uint32_t events, void* data );
+        //Stops watching fd.
+        int remove( int fd );
+        //Waits at most timeout milliseconds (-1 is forever) and returns the amount of ready events,
+        //which are put on events[].
+        int wait( int timeout );
+
+        //Events returned by the last wait().
+        epoll_event events[MAX_EVENTS];
+        //Epoll file descriptor.
+        int epollfd = -1;
+};
@@ -0,0 +1,61 @@
+#include "gapbuffer.h"
+#include <algorithm>
+#include <cstring>
+
+size_t GapBuffer::find( char c, size_t index, size_t limit ) const{
+    limit = std::min( limit, size() );
+    for( ; index < limit; index++ ){
+        if( at( index ) == c ) return index;
+    }
+    return limit;
+}
+
+size_t GapBuffer::findBack( char c, size_t index ) const{
+    for( ; index > 0; index-- ){
+        if( at( index - 1 ) == c ) return index;
+    }
+    return 0;
+}
+
+void GapBuffer::insert( std::string_view text ){
+    //Out of room, make the gap bigger. Doubling keeps typing O(1) on average.
+    if( gapSize() < text.size() ){
+        size_t grow = std::max( { text.size(), data.size(), (size_t) GAP_BUFFER_SIZE } );
+        data.insert( gapEnd, grow, '\0' );
+        gapEnd += grow;
+    }
+    memcpy( &data[gapStart], text.data(), text.size() );
+    gapStart += text.size();
+}
+
+void GapBuffer::erase(){
+    if( gapStart > 0 ) gapStart--;
+}
+
+void GapBuffer::moveTo( size_t index ){
+    index = std::min( index, size() );
+    //Whatever's between the cursor and index goes to the other side of the gap.
+    if( index < gapStart ){
+        size_t amount = gapStart - index;
+        memmove( &data[gapEnd - amount], &data[index], amount );
+        gapStart -= amount;
+        gapEnd -= amount;
+    }
+    else if( index > gapStart ){
+        size_t amount = index - gapStart;
+        memmove( &data[gapStart], &data[gapEnd], amount );
+        gapStart += amount;
+        gapEnd += amount;
+    }
+}
+
+std::string GapBuffer::text() const{
+    std::string text( data, 0, gapStart );
+    text.append( data, gapEnd, std::string::npos );
+    return text;
+}
+
+void GapBuffer::clear(){
+    gapStart = 0;
+    gapEnd = data.size();
+}
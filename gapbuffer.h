@@ -0,0 +1,44 @@
+//Text being edited in the message box.
+//The free space (the gap) is kept where the cursor is, so typing or deleting there only moves the ends of the gap,
+//however long the text is. Moving the cursor moves the gap with it, one character per character moved.
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+//Free space a buffer grows by when the gap runs out, at least.
+#define GAP_BUFFER_SIZE 256
+
+class GapBuffer{
+    public:
+        //Amount of characters in the text.
+        size_t size() const { return data.size() - gapSize(); }
+        bool empty() const { return size() == 0; }
+        //Where the cursor is, the amount of characters before it.
+        size_t cursor() const { return gapStart; }
+        //Character at index.
+        char at( size_t index ) const { return data[ ( index < gapStart ) ? index : index + gapSize() ]; }
+        //Index of the first c from index on, but not at or past limit. Returns limit if there isn't one.
+        size_t find( char c, size_t index, size_t limit ) const;
+        //Index right after the last c before index, 0 if there isn't one.
+        size_t findBack( char c, size_t index ) const;
+        //Inserts text before the cursor, the cursor ends up after it.
+        void insert( std::string_view text );
+        void insert( char c ){ insert( std::string_view( &c, 1 ) ); }
+        //Removes the character before the cursor.
+        void erase();
+        //Moves the cursor to index.
+        void moveTo( size_t index );
+        //The whole text, without the gap.
+        std::string text() const;
+        //Throws out the text, keeping the memory.
+        void clear();
+
+    private:
+        size_t gapSize() const { return gapEnd - gapStart; }
+
+        //Text before the gap, the gap and the text after it.
+        std::string data;
+        //Where the gap starts and where the text after it does.
+        size_t gapStart = 0, gapEnd = 0;
+};
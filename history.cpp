@@ -0,0 +1,109 @@
+#include "history.h"
+#include <algorithm>
+#include <cstring>
+
+History::~History(){
+    delete[] data;
+}
+
+void History::setLimits( size_t maxBytes, size_t maxMessages ){
+    delete[] data;
+    //Offsets are 32 bits.
+    if( maxBytes > UINT32_MAX ) maxBytes = UINT32_MAX;
+    if( maxMessages < 1 ) maxMessages = 1;
+    //Allocated once and never again, the OS only hands us pages as they get used.
+    data = new char[ maxBytes ];
+    capacity = maxBytes;
+    clear();
+    maxSlots = maxMessages;
+    size_t slots = std::min( maxSlots, (size_t) HISTORY_FIRST_SLOTS );
+    offsets.assign( slots, 0 );
+    sizes.assign( slots, 0 );
+    senders.assign( slots, NO_NAME );
+}
+
+void History::grow(){
+    size_t slots = std::min( offsets.size() * 2, maxSlots );
+    std::vector<uint32_t> newOffsets( slots, 0 ), newSizes( slots, 0 ), newSenders( slots, NO_NAME );
+    for( size_t index = 0; index < count; index++ ){
+        newOffsets[index] = offsets[ slot(index) ];
+        newSizes[index] = sizes[ slot(index) ];
+        newSenders[index] = senders[ slot(index) ];
+    }
+    offsets.swap( newOffsets );
+    sizes.swap( newSizes );
+    senders.swap( newSenders );
+    first = 0;
+}
+
+void History::evict(){
+    g_names.release( senders[first] );
+    first = ( first + 1 ) % offsets.size();
+    count--;
+}
+
+uint64_t History::add( std::string_view message, std::string_view sender ){
+    //Wouldn't fit even if we threw everything out, so only keep what fits.
+    if( message.size() > capacity ) message = message.substr( 0, capacity );
+    size_t size = message.size();
+    //Before anything's thrown out, the sender might only be kept by the oldest messages.
+    uint32_t id = g_names.intern( sender );
+
+    //Find room, throwing out the oldest message every time there isn't any.
+    size_t offset;
+    while( true ){
+        //Nothing's there, so start from the beginning.
+        if( count == 0 ){
+            offset = 0;
+            break;
+        }
+        //Out of slots, get more unless there's as many as there can be.
+        if( count == offsets.size() ){
+            if( offsets.size() < maxSlots ) grow();
+            else evict();
+            continue;
+        }
+        //Where the oldest message starts, we can write up to there.
+        size_t tail = offsets[first];
+        //Free space is after the write offset and before the oldest message.
+        if( writeOffset > tail ){
+            if( capacity - writeOffset >= size ){
+                offset = writeOffset;
+                break;
+            }
+            //Doesn't fit before the end, skip it and go to the start.
+            else if( tail >= size ){
+                offset = 0;
+                break;
+            }
+        }
+        //Free space is between the write offset and the oldest message.
+        else if( tail - writeOffset >= size ){
+            offset = writeOffset;
+            break;
+        }
+        evict();
+    }
+
+    memcpy( data + offset, message.data(), size );
+    writeOffset = offset + size;
+
+    size_t added = slot( count );
+    offsets[added] = offset;
+    sizes[added] = size;
+    senders[added] = id;
+    count++;
+    return nextSequence++;
+}
+
+uint64_t History::add( std::string_view message, std::string_view sender, uint64_t sequence ){
+    //Missed some, start over from this one.
+    if( sequence != nextSequence ) clear( sequence );
+    return add( message, sender );
+}
+
+void History::clear( uint64_t next ){
+    while( count ) evict();
+    writeOffset = first = 0;
+    nextSequence = next;
+}
@@ -0,0 +1,79 @@
+//Keeps the latest messages sent on the chatroom, within a fixed amount of memory.
+//The text lives in one ring of bytes and every message gets a slot in a ring of slots, kept as one array per field
+//(where the text is, how long it is, who sent it). Once either ring is full the oldest messages get thrown out to make
+//room, which is O(1) per message. Senders are kept as their number in g_names, so a name isn't stored again with
+//every message it sends.
+//A message's text never wraps around the end of the ring, if it doesn't fit before the end the rest of the ring is
+//skipped and it goes at the start.
+//Every message gets the next sequence number, so the messages kept always have consecutive ones.
+//The ring of slots starts out small and doubles whenever it's full, up to the most messages kept, so a room nobody
+//talks in doesn't cost much. The ring of bytes is allocated whole, but the OS only hands out pages as they're used.
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "names.h"
+
+//Default limits, changed with --history-bytes and --history-messages.
+#define HISTORY_BYTES (8 * 1024 * 1024)
+#define HISTORY_MESSAGES 65536
+//Slots the ring of slots starts out with.
+#define HISTORY_FIRST_SLOTS 64
+
+class History{
+    public:
+        History() = default;
+        //Frees the rings. The senders aren't given back to g_names, histories only go away when the server does.
+        ~History();
+        History(const History&) = delete;
+        History& operator=(const History&) = delete;
+
+        //Allocates the rings, throwing out whatever was there. maxBytes can't be more than 4GB.
+        void setLimits( size_t maxBytes, size_t maxMessages );
+        //Adds a message, throwing out the oldest ones until it fits, and returns it's sequence number.
+        //A message bigger than the whole ring gets cut off.
+        uint64_t add( std::string_view message, std::string_view sender );
+        //Adds a message that already has a sequence number, one a relaying server got from the server above it.
+        //If it isn't the next one everything kept is thrown out first, since what's kept is always consecutive.
+        uint64_t add( std::string_view message, std::string_view sender, uint64_t sequence );
+        //Throws out every message, the next one gets sequence number next.
+        void clear( uint64_t next = 1 );
+        //Amount of messages kept.
+        size_t size() const { return count; }
+        //Sequence number of the oldest message kept, or of the next message if there's none.
+        uint64_t firstSequence() const { return nextSequence - count; }
+        //Sequence number of the newest message, 0 if there never was one.
+        uint64_t lastSequence() const { return nextSequence - 1; }
+        //Sequence number of the index-th oldest message kept.
+        uint64_t sequence( size_t index ) const { return firstSequence() + index; }
+        //Message and name of the index-th oldest message kept, only valid until the next add().
+        std::string_view message( size_t index ) const { return std::string_view( data + offsets[ slot(index) ], sizes[ slot(index) ] ); }
+        std::string_view sender( size_t index ) const { return g_names.name( senders[ slot(index) ] ); }
+        //Number of the sender of the index-th oldest message kept.
+        uint32_t senderId( size_t index ) const { return senders[ slot(index) ]; }
+
+    private:
+        //Slot of the index-th oldest message.
+        size_t slot( size_t index ) const { return ( first + index ) % offsets.size(); }
+        //Throws out the oldest message.
+        void evict();
+        //Doubles the ring of slots (up to maxSlots), the oldest message ends up in the first slot.
+        void grow();
+
+        //Ring of bytes holding the messages.
+        char* data = nullptr;
+        //Size of the ring of bytes.
+        size_t capacity = 0;
+        //Where the next message goes in the ring of bytes.
+        size_t writeOffset = 0;
+        //Ring of slots, one array per field: where the message is in the ring of bytes, it's size and it's sender.
+        std::vector<uint32_t> offsets, sizes, senders;
+        //Oldest slot and amount of slots used.
+        size_t first = 0, count = 0;
+        //Most slots the ring of slots grows to.
+        size_t maxSlots = 0;
+        //Sequence number the next message gets, they start at 1 so 0 can mean none.
+        uint64_t nextSequence = 1;
+};
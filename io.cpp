@@ -1,25 +1,68 @@
 #include "io.h"
+#include "scrollback.h"
+#include "gapbuffer.h"
+#include <algorithm>
+#include <chrono>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+//Panes that changed since the last frame, Render_Frame() only copies those to the screen.
+//The borders, status and room name on stdscr.
+#define PANE_SCREEN 1
+#define PANE_CHAT 2
+#define PANE_MEMBERS 4
+#define PANE_MESSAGE_BOX 8
+
+//Keys wgetch() returns for the start and the end of a paste, the terminal sends everything that was pasted between
+//them (bracketed paste) so it doesn't look like it was typed.
+#define KEY_PASTE_START (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+
+//Color pair the chat box shows color in, every color has it's own so entries in different colors can be on screen at once.
+#define CHAT_PAIR(color) (8 + (color))
 
 //Width and height of the terminal.
 int g_terminalWidth = 0, g_terminalHeight = 0;
 //Window of the message box.
 static Window s_messageBox = {0};
-//String on the message box.
-static std::string s_messageBoxString;
-//Maximum x-position per row. Used for arrow key cursor movement.
-static std::vector<int> s_maxX;
+//Text in the message box. It's shown in rows of the box's width, a row ends after that many characters or at a
+//newline, and the box scrolls once there's more rows than fit. The cursor's row and column are the box's cursorY
+//and cursorX.
+static GapBuffer s_messageBoxText;
+//Where the message box's top row and the row the cursor's on start in s_messageBoxText.
+static size_t s_inputTop = 0, s_cursorRowStart = 0;
 //Used for displaying "Type Message..."
 static bool s_printTypeMessage = false;
+//Are we in the middle of a paste? What's been pasted so far waits in s_paste until the end of it comes in.
+static bool s_pasting = false;
+static std::string s_paste;
+//Did the last Handle_Messages() get a key?
+static bool s_gotInput = false;
+//Keys are read from this one, it's never drawn on. wgetch() refreshes the window it reads from if it changed, which
+//would put the message box on the terminal behind Render_Frame()'s back.
+static WINDOW* s_input = nullptr;
 //Window of our members list.
 static Window s_memberList = {0};
 //Amount of members (written rows) in our line.
 static int s_memberAmount = 0;
-//Window for the chat messages.
+//Window for the chat messages, it only ever holds the lines that are on screen.
 static Window s_chatMessages = {0};
-//The top of drawable area in the chat message pad, used for scrolling.
-static int s_chatTopY = 0;
-//Furthest row you can scroll to in the chat message pad.
-static int s_maxY = 0;
+//Everything written to the chat box.
+static Scrollback s_scrollback;
+//Entry of s_scrollback at the top of the chat box and which of it's lines is, used for scrolling.
+static size_t s_chatTopEntry = 0, s_chatTopLine = 0;
+//Is the chat box scrolled all the way down? It follows new entries then.
+static bool s_chatAtBottom = true;
+//What the top border says, kept to draw it again when the terminal's resized.
+static std::string s_status;
+//Rooms we've been in, TAB goes through them. The one we're in is s_rooms[s_room].
+static std::vector<std::string> s_rooms;
+static size_t s_room = 0;
+//Panes drawn on since the last frame, as PANE_ flags.
+static int s_dirtyPanes = 0;
+//Shortest time between two frames (--fps), and when the last one went out.
+static std::chrono::milliseconds s_frameInterval( 1000 / DEFAULT_FPS );
+static std::chrono::steady_clock::time_point s_lastFrame;
 
 void Initialize_Screen(){
     //Initialize ncurses.
@@ -34,35 +77,233 @@ void Initialize_Screen(){
     getmaxyx(stdscr, g_terminalHeight, g_terminalWidth);
     //Clear screen.
     clear();
+    //Have the terminal mark pastes, and tell ncurses the keys it marks them with.
+    printf("\033[?2004h");
+    fflush(stdout);
+    define_key( "\033[200~", KEY_PASTE_START );
+    define_key( "\033[201~", KEY_PASTE_END );
+    //Allows special keys, and doesn't wait for them. It starts out touched like every new window, which would have the
+    //first wgetch() draw it.
+    s_input = newwin( 1, 1, 0, 0 );
+    keypad( s_input, TRUE );
+    nodelay( s_input, TRUE );
+    untouchwin( s_input );
+}
+
+//Entry and line at the top of the chat box when the last line is at the bottom, the furthest you can scroll to.
+//Only wraps the entries that fit in the chat box.
+static void Chat_Bottom( size_t& entry, size_t& line ){
+    size_t rows = s_chatMessages.height;
+    for( entry = s_scrollback.size(); entry > 0; entry-- ){
+        size_t lines = s_scrollback.lines( entry - 1 );
+        if( lines >= rows ){
+            entry--;
+            line = lines - rows;
+            return;
+        }
+        rows -= lines;
+    }
+    //Everything fits.
+    entry = line = 0;
+}
+
+//Scrolls the chat box by amount lines, up if it's negative. Only wraps the entries it goes past.
+static void Scroll_Chat( int amount ){
+    size_t bottomEntry, bottomLine;
+    Chat_Bottom( bottomEntry, bottomLine );
+    //Wherever we are it's the last line we can start on.
+    if( s_chatAtBottom ){
+        s_chatTopEntry = bottomEntry;
+        s_chatTopLine = bottomLine;
+    }
+    //The entry might have less lines than it did when it was wrapped at another width.
+    if( s_chatTopEntry < s_scrollback.size() ){
+        s_chatTopLine = std::min( s_chatTopLine, s_scrollback.lines( s_chatTopEntry ) - 1 );
+    }
+    for( ; amount < 0; amount++ ){
+        if( s_chatTopLine > 0 ) s_chatTopLine--;
+        else if( s_chatTopEntry > 0 ) s_chatTopLine = s_scrollback.lines( --s_chatTopEntry ) - 1;
+    }
+    for( ; amount > 0; amount-- ){
+        if( s_chatTopLine + 1 < s_scrollback.lines( s_chatTopEntry ) ) s_chatTopLine++;
+        else if( s_chatTopEntry + 1 < s_scrollback.size() ){
+            s_chatTopEntry++;
+            s_chatTopLine = 0;
+        }
+    }
+    //Clamp to the bottom.
+    s_chatAtBottom = std::make_pair( s_chatTopEntry, s_chatTopLine ) >= std::make_pair( bottomEntry, bottomLine );
+}
+
+//Makes a window with it's top left corner at x, y, or moves and resizes it if it's already there.
+static void Place_Window( Window& window, int height, int width, int y, int x ){
+    //Too small to make one.
+    height = std::max( height, 1 );    width = std::max( width, 1 );
+    if( !window.win ) window.win = newwin( height, width, y, x );
+    else{
+        //Shrink it before moving it, it can't go off the screen.
+        wresize( window.win, height, width );
+        mvwin( window.win, y, x );
+    }
+    //Get width and height of the window.
+    getmaxyx(window.win, window.height, window.width);
+    window.x = x;    window.y = y;
+}
+
+//Where the row after the one starting at rowStart starts in the message box, std::string::npos if it's the last one.
+//length gets the amount of characters on the row, without the newline that ends it.
+static size_t Next_Row( size_t rowStart, size_t* length = nullptr ){
+    size_t width = s_messageBox.width;
+    size_t end = std::min( rowStart + width, s_messageBoxText.size() );
+    size_t newline = s_messageBoxText.find( '\n', rowStart, end );
+    size_t next = std::string::npos;
+    if( newline < end ) next = newline + 1;
+    //Full, the next row has the rest of the line even if there's nothing left of it.
+    else if( end == rowStart + width ) next = end;
+    if( length ) *length = newline - rowStart;
+    return next;
+}
+
+//Where the row before the one starting at rowStart starts in the message box, it can't be the first one.
+static size_t Previous_Row( size_t rowStart ){
+    size_t width = s_messageBox.width;
+    //It's the last row of the line before.
+    if( s_messageBoxText.at( rowStart - 1 ) == '\n' ){
+        size_t lineStart = s_messageBoxText.findBack( '\n', rowStart - 1 );
+        return lineStart + ( rowStart - 1 - lineStart ) / width * width;
+    }
+    return rowStart - width;
+}
+
+//Draws the message box from row and col (where rowStart is) down, only repainting what an edit there changed.
+//It stops after the line the edit was on unless it's last row ended up reflowLength long, which it only is if the
+//edit changed the amount of rows the line takes (0 after inserting, width - 1 after deleting), since then everything
+//below moved. -1 always goes to the bottom.
+static void Draw_Input( int row, size_t rowStart, int col, int reflowLength ){
+    for( ; row < s_messageBox.height; row++, col = 0 ){
+        size_t length;
+        size_t next = Next_Row( rowStart, &length );
+        wmove( s_messageBox.win, row, col );
+        for( size_t i = rowStart + col; i < rowStart + length; i++ ) waddch( s_messageBox.win, (unsigned char) s_messageBoxText.at(i) );
+        //A full row already moved the cursor to the next one.
+        if( length < (size_t) s_messageBox.width ) wclrtoeol( s_messageBox.win );
+        bool lineEnd = next == std::string::npos || s_messageBoxText.at( next - 1 ) == '\n';
+        bool reflowed = reflowLength < 0 || length == (size_t) reflowLength;
+        if( lineEnd && !reflowed ) return;
+        //Last row, whatever was below it isn't there anymore.
+        if( next == std::string::npos ){
+            if( row + 1 < s_messageBox.height ){
+                wmove( s_messageBox.win, row + 1, 0 );
+                wclrtobot( s_messageBox.win );
+            }
+            return;
+        }
+        rowStart = next;
+    }
+}
+
+//Scrolls the message box so the cursor's row is in it, returns true if it did (and drew all of it again).
+static bool Scroll_Input(){
+    if( s_messageBox.cursorY < 0 ){
+        s_inputTop = s_cursorRowStart;
+        s_messageBox.cursorY = 0;
+    }
+    else if( s_messageBox.cursorY >= s_messageBox.height ){
+        for( ; s_messageBox.cursorY >= s_messageBox.height; s_messageBox.cursorY-- ) s_inputTop = Next_Row( s_inputTop );
+    }
+    else return false;
+    Draw_Input( 0, s_inputTop, 0, -1 );
+    return true;
+}
+
+//Moves the cursor's row and column past c, the character after the cursor. Doesn't move the cursor in the text.
+static void Step_Right( char c ){
+    if( c == '\n' || s_messageBox.cursorX + 1 == s_messageBox.width ){
+        s_cursorRowStart = ( c == '\n' ) ? s_cursorRowStart + s_messageBox.cursorX + 1 : s_cursorRowStart + s_messageBox.width;
+        s_messageBox.cursorX = 0;
+        s_messageBox.cursorY++;
+    }
+    else s_messageBox.cursorX++;
+}
+
+//Inserts text at the cursor and repaints from there, see Draw_Input() for reflowLength.
+static void Insert_Text( std::string_view text, int reflowLength ){
+    int row = s_messageBox.cursorY, col = s_messageBox.cursorX;
+    size_t rowStart = s_cursorRowStart;
+    s_messageBoxText.insert( text );
+    for( char c : text ) Step_Right( c );
+    if( !Scroll_Input() ) Draw_Input( row, rowStart, col, reflowLength );
+}
+
+//Moves the cursor's row and column back by a character, there has to be one. Doesn't move the cursor in the text.
+static void Step_Left(){
+    if( s_messageBox.cursorX > 0 ){
+        s_messageBox.cursorX--;
+        return;
+    }
+    size_t previous = Previous_Row( s_cursorRowStart );
+    s_messageBox.cursorX = s_messageBoxText.cursor() - 1 - previous;
+    s_cursorRowStart = previous;
+    s_messageBox.cursorY--;
+}
+
+//Moves the cursor to col on the row starting at rowStart, or to the end of the row if it's shorter.
+static void Move_Cursor( size_t rowStart, int col ){
+    size_t length;
+    Next_Row( rowStart, &length );
+    //The end of a full row is the start of the next one.
+    if( length == (size_t) s_messageBox.width ) length--;
+    s_messageBox.cursorX = std::min<size_t>( col, length );
+    s_cursorRowStart = rowStart;
+    s_messageBoxText.moveTo( rowStart + s_messageBox.cursorX );
+}
+
+//Writes the text into the message box again, for when it's width changed. The cursor's row stays as far down as
+//there's rows above it.
+static void Reflow_MessageBox(){
+    size_t cursor = s_messageBoxText.cursor();
+    size_t lineStart = s_messageBoxText.findBack( '\n', cursor );
+    s_cursorRowStart = lineStart + ( cursor - lineStart ) / s_messageBox.width * s_messageBox.width;
+    s_messageBox.cursorX = cursor - s_cursorRowStart;
+    s_inputTop = s_cursorRowStart;
+    for( s_messageBox.cursorY = 0; s_messageBox.cursorY + 1 < s_messageBox.height && s_inputTop > 0; s_messageBox.cursorY++ ){
+        s_inputTop = Previous_Row( s_inputTop );
+    }
+    Draw_Input( 0, s_inputTop, 0, -1 );
+    //Has "Type Message..." written again if it's empty.
+    s_printTypeMessage = false;
 }
 
 void Initialize_SubWindows(int messageX1, int messageY1, int messageX2, int messageY2,
                            int memberX1,  int memberY1,  int memberX2,  int memberY2,
                            int chatX1,    int chatY1,    int chatX2,    int chatY2){
+    bool resized = s_messageBox.win;
     //Calculate message box subwindow borders.
-    s_messageBox.win = newwin( messageY2 - messageY1, messageX2 - messageX1, messageY1, messageX1 );
+    Place_Window( s_messageBox, messageY2 - messageY1, messageX2 - messageX1, messageY1, messageX1 );
+    //Whatever was typed wraps at the new width.
+    if( resized ) Reflow_MessageBox();
     //Set cursor position.
     wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-    //Allows special keys.
-    keypad(s_messageBox.win, TRUE);
-    //Get width and height of the message subwindow.
-    getmaxyx(s_messageBox.win, s_messageBox.height, s_messageBox.width);
-    //Non-blocking, single-thread safe.
-    wtimeout(s_messageBox.win, 0);
 
     //Calculate member list subwindow borders.
-    s_memberList.win = newwin( memberY2 - memberY1, memberX2 - memberX1, memberY1, memberX1 );
-    //Get width and height of the member list subwindow.
-    getmaxyx(s_memberList.win, s_memberList.height, s_memberList.width);
-    
-    //Creates pad ( like a window but can scroll ) for the chat box.
-    s_chatMessages.win = newpad(chatX2 - chatX1, 1000);
-    //Initializing values.
-    s_chatMessages.width = chatX2 - chatX1;   s_chatMessages.height = chatY2 - chatY1;
-    s_chatMessages.x = chatX1;                s_chatMessages.y = chatY1;
-    //Activate special keys and makes it non-blocking.
-    keypad(s_chatMessages.win, TRUE);
-    wtimeout(s_chatMessages.win, 0);
+    Place_Window( s_memberList, memberY2 - memberY1, memberX2 - memberX1, memberY1, memberX1 );
+
+    //Calculate chat box subwindow borders, scrolling is done by drawing other lines of s_scrollback in it.
+    Place_Window( s_chatMessages, chatY2 - chatY1, chatX2 - chatX1, chatY1, chatX1 );
+    //Lines wrap at the chat box's right border. When that moves only the entries on screen are wrapped again now,
+    //the rest are once they're scrolled to.
+    s_scrollback.setWidth( s_chatMessages.width );
+    Scroll_Chat( 0 );
+}
+
+void Resize_Screen(){
+    //ncurses doesn't get SIGWINCH (it comes in through the signalfd), so tell it the new size ourselves.
+    winsize size;
+    if( ioctl( STDOUT_FILENO, TIOCGWINSZ, &size ) == 0 ) resizeterm( size.ws_row, size.ws_col );
+    getmaxyx(stdscr, g_terminalHeight, g_terminalWidth);
+    //The borders are all in other places now, and who knows what the terminal did with what was on it.
+    werase( stdscr );
+    clearok( curscr, TRUE );
 }
 
 void End_Screen(){
@@ -70,8 +311,12 @@ void End_Screen(){
     delwin(s_messageBox.win);
     delwin(s_memberList.win);
     delwin(s_chatMessages.win);
+    delwin(s_input);
     //Bring back cursor.
     curs_set(1);
+    //Pastes look like typing again.
+    printf("\033[?2004l");
+    fflush(stdout);
     //Allow for printing inputted characters
     echo();
     //fin.
@@ -104,202 +349,196 @@ void Draw_UI(){
     //Deactivates bold text.
     attroff(A_BOLD);
 
-    //Print the number of clients connected.
-    mvwprintw(s_memberList.win, 0, 3, "Members-1");
+    //Print the number of clients connected, there's always us.
+    mvwprintw(s_memberList.win, 0, 3, "Members-%d", std::max( s_memberAmount, 1 ));
+    //Put the status and the room back on the borders, if there's any yet.
+    if( !s_status.empty() ) Write_Status( s_status );
+    if( !s_rooms.empty() ) Write_Room( s_rooms[s_room] );
 
-    //Present to the audience!
-    refresh();
-    wrefresh(s_memberList.win);
+    //Presented to the audience with the first frame.
+    s_dirtyPanes |= PANE_SCREEN | PANE_CHAT | PANE_MEMBERS | PANE_MESSAGE_BOX;
 }
 
-void Increase_MaxX(int row, int width, int height){
-    //Can't go down anymore.
-    if( row >= height ) return;
-    //Increase maxX on the current row.
-    s_maxX.at(row)++;
-    //Increase s_maxX on the next row if the current row is bigger than the width.
-    if( s_maxX.at( row ) >= width ){
-        //Undo the increment on the current row.
-        s_maxX.at(row)--;
-        //Go to the next row
-        row++;
-        //Handle MaxX on that row.
-        Increase_MaxX(row, width, height);
-    }
+//Adds an entry to the chat box, text from colorFrom to colorTo is in color.
+static void Write_Chat( std::string_view text, short color, size_t colorFrom, size_t colorTo ){
+    //If we are at the bottom it scrolls automatically, if we aren't nothing on screen moves.
+    s_scrollback.add( text, color, colorFrom, colorTo );
+    //Shown with the next frame, along with everything else that came in before it.
+    s_dirtyPanes |= PANE_CHAT;
 }
 
-void Decrease_MaxX(int row, int width, int height){
-    //Can't go up.
-    if( row >= height ) return;
-    //Current row is full, check the row under it.
-    if( s_maxX.at(row) == width - 1 ){
-        Decrease_MaxX( row + 1, width, height);
-    }
-    //There's nothing below, so decrease MaxX on the current row.
-    else{
-        s_maxX.at(row)--;
+//Draws the lines of s_scrollback that are in the chat box, a whole line at a time. However many entries there are
+//it's never more than a screenful, and only the entries on screen get wrapped.
+static void Draw_Chat(){
+    if( s_chatAtBottom ) Chat_Bottom( s_chatTopEntry, s_chatTopLine );
+    werase( s_chatMessages.win );
+    size_t index = s_chatTopEntry, line = s_chatTopLine;
+    for( int row = 0; row < s_chatMessages.height && index < s_scrollback.size(); row++ ){
+        std::string_view text = s_scrollback.line( index, line );
+        //Where the colored part is on this line, if it's on it at all.
+        size_t start = s_scrollback.lineStart( index, line );
+        size_t colorFrom = std::clamp( s_scrollback.colorFrom( index ), start, start + text.size() ) - start;
+        size_t colorTo = std::clamp( s_scrollback.colorTo( index ), start, start + text.size() ) - start;
+        short pair = CHAT_PAIR( s_scrollback.color( index ) );
+        init_pair( pair, s_scrollback.color( index ), COLOR_BLACK );
+        wmove( s_chatMessages.win, row, 0 );
+        waddnstr( s_chatMessages.win, text.data(), colorFrom );
+        wattron( s_chatMessages.win, COLOR_PAIR(pair) );
+        waddnstr( s_chatMessages.win, text.data() + colorFrom, colorTo - colorFrom );
+        wattroff( s_chatMessages.win, COLOR_PAIR(pair) );
+        waddnstr( s_chatMessages.win, text.data() + colorTo, text.size() - colorTo );
+        //Next line, which might be on the next entry.
+        if( ++line >= s_scrollback.lines( index ) ){
+            index++;
+            line = 0;
+        }
     }
 }
 
-std::string Handle_Messages(){
-    //Change cursor position.
-    wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-    //Show cursor.
-    curs_set(1);
+//Handles a single key, returns the message if it sent one.
+static std::string Handle_Key( int ch ){
+    //Whatever the key does, the message box shows it (or at least where the cursor is) with the next frame.
+    s_dirtyPanes |= PANE_MESSAGE_BOX;
+    if( ch == KEY_PPAGE || ch == KEY_NPAGE ) s_dirtyPanes |= PANE_CHAT;
+    //Where the cursor was, edits repaint from there.
+    int col = s_messageBox.cursorX;
+    std::string message;
 
-    //Print "Type Message..." if message box is empty and if we haven't printed it yet.
-    if( !s_messageBoxString.length() && !s_printTypeMessage ){
-        //Dim the text.
-        wattron(s_messageBox.win, A_DIM);
-        mvwprintw(s_messageBox.win, 0, 0, "Type Message...");
-        wattroff(s_messageBox.win, A_DIM);
-        //Move cursor to it's original position.
-        wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-        s_printTypeMessage = true;
-    }
-    //Remove "Type Message" if the message box has text and we haven't cleared it already
-    else if( s_messageBoxString.length() > 0 && s_printTypeMessage ){
-        //Clear "Type Message...".
-        mvwprintw(s_messageBox.win, 0, 0, "               ");
-        //Rewrite the text in the message box.
-        mvwprintw(s_messageBox.win, 0, 0, "%s", s_messageBoxString.c_str());
-        //Move cursor to it's orignal position.
-        wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-        s_printTypeMessage = false;
+    //Everything between the start and the end of a paste goes in as one block once it's all there, newlines and
+    //all, so a paste of many lines is one message. Tabs become a space, other control characters get dropped.
+    if( s_pasting ){
+        if( ch == KEY_PASTE_END ){
+            Insert_Text( s_paste, -1 );
+            s_paste.clear();
+            s_pasting = false;
+        }
+        else if( ch == '\n' || ch == '\r' ) s_paste += '\n';
+        else if( ch == '\t' ) s_paste += ' ';
+        else if( ch >= 32 && ch <= 126 ) s_paste += (char) ch;
+        return message;
     }
-
-    //Initialize s_maxX if it wasn't already (uninitialized vectors are always empty).
-    //Reserves enough space for all rows so we wouldn't need to realloc.
-    if(s_maxX.empty()){
-        s_maxX.resize( s_messageBox.height );
-        //-1 so that when we increase s_maxX on it, it goes to 0 (which is the leftmost coordinate-).
-        std::fill( s_maxX.begin(), s_maxX.end(), -1);
-        //Except for the first line.
-        s_maxX.at(0) = 0;
+    if( ch == KEY_PASTE_START ){
+        s_pasting = true;
+        return message;
     }
 
-    //Retrieve user input.
-    int ch = wgetch(s_messageBox.win);
-    //No input?
-    if( ch == ERR ){
-        return "";
-    }
     //if Enter was pressed and we have text, clear the message box and return the string.
-    else if( ch == '\n' && s_messageBoxString.size() > 0 ){
+    //Newlines at the end are left out, there's nothing after them.
+    if( ch == '\n' && !s_messageBoxText.empty() ){
+        message = s_messageBoxText.text();
+        message.erase( message.find_last_not_of( '\n' ) + 1 );
+        s_messageBoxText.clear();
         //Move to 0, 0.
-        s_messageBox.cursorX = 0;    s_messageBox.cursorY = 0;
-        wmove( s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX );
-        //Clear the message box.
-        wclear(s_messageBox.win);
-        //Copy the message box string temporarily.
-        std::string temp = s_messageBoxString;
-        //Clear the original message box string.
-        s_messageBoxString.clear();
-        //Reset MaxX.
-        for( auto i : s_maxX ) i = -1;
-        s_maxX[0] = 0;
-        //Return the message box string.
-        return temp;
-    }
-    //Character is printable, so print it.
+        s_messageBox.cursorX = s_messageBox.cursorY = 0;
+        s_inputTop = s_cursorRowStart = 0;
+        werase( s_messageBox.win );
+    }
+    //Character is printable, so insert it. Only the rest of it's line gets repainted.
     else if( ch >= 32 && ch <= 126 ){
-        //Get current cursor x/y position.
-        getyx(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-        //Converts 2D coordinate to 1D array index.
-        int index = s_messageBox.cursorY * s_messageBox.width + s_messageBox.cursorX;
-        //Inserts character to the string at the index.
-        s_messageBoxString.insert(index, 1, (char) ch);
-        //Go to the next X position.
-        s_messageBox.cursorX++;
-        //Wrap to the left border if it exceeds the messageBox width.
-        wrap_right(s_messageBox);
-        //Redraws all the characters in the message box starting from index to show the
-        //character insertion.
-        for( int i = index; i < s_messageBoxString.size(); i++ ){
-            waddch( s_messageBox.win, (char)s_messageBoxString.at(i));
-        }
-        //waddch moves the cursor, so move the cursor back to it's original position.
-        wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
-        //Update MaxX on the current row.
-        Increase_MaxX(s_messageBox.cursorY, s_messageBox.width, s_messageBox.height);
+        char c = ch;
+        Insert_Text( std::string_view( &c, 1 ), 0 );
     }
     //Delete character before cursor position.
     //Some terminals send '\b' when backspace is pressed, and some terminal send '\x7F'.
     else if( ch == KEY_BACKSPACE || ch == '\b' || ch == '\x7F' ){
-        //Only works if there even is any text and we have something to delete.
-        if( s_messageBoxString.length() > 0 && (s_messageBox.cursorX > 0 || s_messageBox.cursorY > 0) ){
-            //Decrease cursor position.
-            s_messageBox.cursorX--;
-            //Wrap around and go up if we reached left boundary.
-            wrap_left(s_messageBox);
-
-            //Calculates the index.
-            int index = s_messageBox.cursorY * s_messageBox.width + s_messageBox.cursorX;
-            //Erase character at that position.
-            s_messageBoxString.erase( index, 1 );
-            //Redraws the entire message box content from the string buffer
-            //Fills the rest with blanks.
-            for( int i = 0; i < s_messageBox.width * s_messageBox.height; i++ ){
-                int x = i % s_messageBox.width;
-                int y = i / s_messageBox.width;
-                if(i < s_messageBoxString.size()) mvwaddch(s_messageBox.win, y, x, (char) s_messageBoxString.at(i));
-                else mvwaddch(s_messageBox.win, y, x, ' ');;
+        //Only works if we have something to delete.
+        if( s_messageBoxText.cursor() > 0 ){
+            char deleted = s_messageBoxText.at( s_messageBoxText.cursor() - 1 );
+            Step_Left();
+            s_messageBoxText.erase();
+            //Joining two lines moves everything below.
+            if( !Scroll_Input() ){
+                Draw_Input( s_messageBox.cursorY, s_cursorRowStart, s_messageBox.cursorX, ( deleted == '\n' ) ? -1 : s_messageBox.width - 1 );
             }
-            //Update cursor position.
-            wmove( s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX );
-            //Decrease MaxX on the current line.
-            Decrease_MaxX(s_messageBox.cursorY, s_messageBox.width, s_messageBox.height);
         }
     }
     //Move cursor to the right.
     else if( ch == KEY_RIGHT ){
-        //Increase cursor position.
-        s_messageBox.cursorX++;
-        //Wrap to the left border.
-        wrap_right(s_messageBox);
-        //Cursor's x-position musn't be higher than maxX.
-        if( s_messageBox.cursorX > s_maxX.at(s_messageBox.cursorY) ) s_messageBox.cursorX = s_maxX.at(s_messageBox.cursorY);
-        //Update cursor position.
-        wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
+        if( s_messageBoxText.cursor() < s_messageBoxText.size() ){
+            Step_Right( s_messageBoxText.at( s_messageBoxText.cursor() ) );
+            s_messageBoxText.moveTo( s_messageBoxText.cursor() + 1 );
+            Scroll_Input();
+        }
     }
     //Move cursor to the left.
     else if( ch == KEY_LEFT ){
-        //Decrease cursor x position.
-        s_messageBox.cursorX--;
-        //Wrap to the right border.
-        wrap_left(s_messageBox);
-        //The cursor went out-of-bounds, undo what we just did.
-        if( s_messageBox.cursorY < 0 ){
-            s_messageBox.cursorX++;
-            wrap_right(s_messageBox);
+        if( s_messageBoxText.cursor() > 0 ){
+            Step_Left();
+            s_messageBoxText.moveTo( s_messageBoxText.cursor() - 1 );
+            Scroll_Input();
+        }
+    }
+    //Move the cursor a row up or down, keeping it's column if the row is long enough.
+    else if( ch == KEY_UP ){
+        if( s_cursorRowStart > 0 ){
+            Move_Cursor( Previous_Row( s_cursorRowStart ), col );
+            s_messageBox.cursorY--;
+            Scroll_Input();
+        }
+    }
+    else if( ch == KEY_DOWN ){
+        size_t next = Next_Row( s_cursorRowStart );
+        if( next != std::string::npos ){
+            Move_Cursor( next, col );
+            s_messageBox.cursorY++;
+            Scroll_Input();
         }
-        //Update cursor position.
-        wmove(s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX);
+    }
+    //Move the cursor to the start or the end of it's row.
+    else if( ch == KEY_HOME ){
+        Move_Cursor( s_cursorRowStart, 0 );
+    }
+    else if( ch == KEY_END ){
+        Move_Cursor( s_cursorRowStart, s_messageBox.width );
+    }
+    //Switch to the next room we've been in.
+    else if( ch == '\t' && s_rooms.size() > 1 ){
+        return "/join " + s_rooms[ ( s_room + 1 ) % s_rooms.size() ];
     }
     //Scroll the chat messages up by 3 units and clamp to the top.
     else if( ch == KEY_PPAGE ){
-        s_chatTopY -= 3;
-        if( s_chatTopY < 0 ) s_chatTopY = 0;
+        Scroll_Chat( -3 );
     }
     //Scroll the chat messages down by 3 units and clamp to the bottom.
     else if( ch == KEY_NPAGE ){
-        s_chatTopY += 3;
-        if( s_chatTopY > s_maxY ) s_chatTopY = s_maxY;
+        Scroll_Chat( 3 );
     }
 
-    //Refresh the chat messages pad.
-    prefresh( s_chatMessages.win, s_chatTopY, 0, s_chatMessages.y, s_chatMessages.x,
-              s_chatMessages.y + s_chatMessages.height, s_chatMessages.x + s_chatMessages.width);
+    return message;
+}
+
+std::string Handle_Messages(){
+    //Show cursor.
+    curs_set(1);
+    //Handle every key that's waiting, not just one per pass through the main loop, so a burst of them costs one
+    //frame. Stops at a message so it gets sent before the keys after it are handled.
+    std::string message;
+    int ch = ERR;
+    while( message.empty() && ( ch = wgetch(s_input) ) != ERR ) message = Handle_Key( ch );
+    //There might be more keys behind the one that sent a message.
+    s_gotInput = ( ch != ERR );
 
-    //Present the new window.
-    wrefresh(s_messageBox.win);
+    //Print "Type Message..." if message box is empty and if we haven't printed it yet.
+    if( s_messageBoxText.empty() && !s_printTypeMessage ){
+        //Dim the text.
+        wattron(s_messageBox.win, A_DIM);
+        mvwprintw(s_messageBox.win, 0, 0, "Type Message...");
+        wattroff(s_messageBox.win, A_DIM);
+        s_printTypeMessage = true;
+        s_dirtyPanes |= PANE_MESSAGE_BOX;
+    }
+    //Remove "Type Message" if the message box has text and we haven't cleared it already
+    else if( !s_messageBoxText.empty() && s_printTypeMessage ){
+        //Rewrite the text in the message box, over "Type Message...".
+        Draw_Input( 0, s_inputTop, 0, -1 );
+        s_printTypeMessage = false;
+        s_dirtyPanes |= PANE_MESSAGE_BOX;
+    }
 
-    return "";
+    return message;
 }
 
-void Write_Member( short pair, int row, std::string memberName ){
-    //Hide cursor.
-    curs_set(0);
+void Write_Member( short pair, int row, std::string_view memberName ){
     //Change cursor position inside the member list.
     wmove( s_memberList.win, row, 0 );
     //Clear the line.
@@ -307,11 +546,10 @@ void Write_Member( short pair, int row, std::string memberName ){
     //Activate color attribute.
     wattron(s_memberList.win, COLOR_PAIR(pair));
     //Write at most s_memberList.width characters from memberName in our line.
-    wprintw(s_memberList.win, "%.*s", s_memberList.width, memberName.c_str() );
+    wprintw(s_memberList.win, "%.*s", std::min<int>( s_memberList.width, memberName.size() ), memberName.data() );
     //Disactivate color attribute.
     wattroff(s_memberList.win, COLOR_PAIR(pair));
-    //Update window.
-    wrefresh( s_memberList.win );
+    s_dirtyPanes |= PANE_MEMBERS;
 }
 
 void Update_MemberCount(){
@@ -320,11 +558,10 @@ void Update_MemberCount(){
     wclrtoeol( s_memberList.win );
     //Rewrite it.
     mvwprintw( s_memberList.win, 0, 3, "Members-%d", s_memberAmount);
-    //Refresh
-    wrefresh( s_memberList.win );
+    s_dirtyPanes |= PANE_MEMBERS;
 }
 
-void Insert_Member( short color, std::string memberName ){
+void Insert_Member( short color, std::string_view memberName ){
     //Create the color pair.
     init_pair(1, color, COLOR_BLACK );
     //Set the row to the latest row.
@@ -339,9 +576,9 @@ void Insert_Member( short color, std::string memberName ){
     Update_MemberCount();
 }
 
-void Remove_Member( std::string memberName ){
+void Remove_Member( std::string_view memberName ){
     //Member names are cut off after the memberList window's width.
-    std::string writtenName = memberName.substr(0, s_memberList.width);
+    std::string_view writtenName = memberName.substr(0, s_memberList.width);
     int i;
     //Find in which row the memberName is.
     for( i = 0; i < s_memberAmount; i++ ){
@@ -364,71 +601,105 @@ void Remove_Member( std::string memberName ){
     s_memberAmount--;
 
     Update_MemberCount();
+}
 
-    //Refresh.
-    wrefresh( s_memberList.win );
+void Clear_Members(){
+    //Clear everything below the member count.
+    wmove( s_memberList.win, 1, 0 );
+    wclrtobot( s_memberList.win );
+    s_memberAmount = 0;
+    //Update_MemberCount() marks it for the next frame.
+    Update_MemberCount();
 }
 
-//Message will be formatted as "<sender> : message".
-void Write_Message(std::string message, std::string sender, short color ){
-    //Hide cursor
-    curs_set(0);
-    //Initialize color pair.
-    init_pair(2, color, COLOR_BLACK);
-    //Change the cursor's position.
-    wmove(s_chatMessages.win, s_chatMessages.cursorY, 0);
-    //Print "<"
-    wprintw(s_chatMessages.win, "<");
-    //Activate color pair.
-    wattron(s_chatMessages.win, COLOR_PAIR(2));
-    //Print the sender string so that only it will be differently colored.
-    wprintw(s_chatMessages.win, "%s", sender.c_str());
-    //Turn off color pair.
-    wattroff(s_chatMessages.win, COLOR_PAIR(2));
-    wprintw(s_chatMessages.win, "> : ");
-    //Get current x position for use in the next loop.
-    s_chatMessages.cursorX = getcurx( s_chatMessages.win );
-    //Print the message with wrapping.
-    for( int i = 0; i < message.length(); i++ ){
-        mvwaddch(s_chatMessages.win, s_chatMessages.cursorY, s_chatMessages.cursorX, message.at(i));
-        s_chatMessages.cursorX++;
-        wrap_right(s_chatMessages);
-    }
-    //Get the new cursor y position..
-    s_chatMessages.cursorY = getcury(s_chatMessages.win);
-    //Y position points to the last line of our current message, increase it to go below it.
-    s_chatMessages.cursorY++;
-    s_chatMessages.cursorX = 0;
-    //Update the maxY variable if the y cursor exceeds the visible height.
-    if( s_chatMessages.cursorY > s_chatMessages.height ) s_maxY = s_chatMessages.cursorY - s_chatMessages.height;
-    //Automatically scroll if we are at the bottom.
-    if( s_chatTopY == s_maxY - 1 ) s_chatTopY = s_maxY;
-
-    //Refresh the pad window.
-    prefresh(s_chatMessages.win, s_chatTopY, 0, s_chatMessages.y, s_chatMessages.x,
-             s_chatMessages.y + s_chatMessages.height, s_chatMessages.x + s_chatMessages.width);
-}
-
-void Write_Connection(std::string name, int state ){
-    //Hide cursor.
-    curs_set(0);
-    //Create color pair.
-    init_pair(3, COLOR_YELLOW, COLOR_BLACK);
-    //Move cursor.
-    wmove( s_chatMessages.win, s_chatMessages.cursorY, 0 );
-    //Print the connection message.
-    wattron( s_chatMessages.win, COLOR_PAIR(3) );
-    if( state == CONNECTED )    wprintw( s_chatMessages.win, "-- %s connected! --", name.c_str());
-    else                        wprintw( s_chatMessages.win, "-- %s disconnected! --", name.c_str());
-    wattroff( s_chatMessages.win, COLOR_PAIR(3) );
-    //Get the new y position.
-    s_chatMessages.cursorY = getcury( s_chatMessages.win );
-    //Make cursorY point to the line below the connection message.
-    s_chatMessages.cursorY++;
-    //the x cursor'll always be 0 :`)
-    s_chatMessages.cursorX = 0;
-
-    //Refresh the pad.
-    prefresh(s_chatMessages.win, s_chatTopY, 0, s_chatMessages.y, s_chatMessages.x, 
-             s_chatMessages.y + s_chatMessages.height, s_chatMessages.x + s_chatMessages.width);
+//Message will be formatted as "<sender> : message", with only the sender in color.
+void Write_Message( std::string_view message, std::string_view sender, short color ){
+    std::string text;
+    text.reserve( sender.size() + message.size() + 5 );
+    text.append( "<" ).append( sender ).append( "> : " ).append( message );
+    Write_Chat( text, color, 1, 1 + sender.size() );
+}
+
+void Write_Connection( std::string_view name, int state ){
+    std::string text = "-- ";
+    text.append( name ).append( ( state == CONNECTED ) ? " connected! --" : " disconnected! --" );
+    Write_Chat( text, COLOR_YELLOW, 0, text.size() );
+}
+
+void Write_Notice( std::string notice ){
+    //Same color as connection messages.
+    std::string text = "-- " + notice + " --";
+    Write_Chat( text, COLOR_YELLOW, 0, text.size() );
+}
+
+void Write_Status( std::string status ){
+    s_status = status;
+    //Status goes on the top border above the chat messages, redraw the border to get rid of the old one.
+    int width = g_terminalWidth - 19;
+    attron(A_BOLD);
+    mvhline(0, 1, ACS_HLINE, width);
+    if( !status.empty() ) mvprintw(0, 2, " %.*s ", std::max( width - 4, 0 ), status.c_str());
+    attroff(A_BOLD);
+    s_dirtyPanes |= PANE_SCREEN;
+}
+
+bool Input_Pending(){
+    return s_gotInput;
+}
+
+void Set_FrameRate( int fps ){
+    s_frameInterval = std::chrono::milliseconds( ( fps > 0 ) ? 1000 / fps : 0 );
+}
+
+void Render_Frame(){
+    if( !s_dirtyPanes ) return;
+    auto now = std::chrono::steady_clock::now();
+    //Too soon, whatever else changes until the next one goes out with it.
+    if( now - s_lastFrame < s_frameInterval ) return;
+    //Every pane is copied to ncurses' idea of the screen, and the terminal only gets what's different once they all are.
+    if( s_dirtyPanes & PANE_SCREEN ){
+        wnoutrefresh( stdscr );
+        //It's under every other window, so they have to be copied again whole.
+        touchwin( s_memberList.win );
+        touchwin( s_messageBox.win );
+        s_dirtyPanes |= PANE_CHAT | PANE_MEMBERS;
+    }
+    if( s_dirtyPanes & PANE_CHAT ){
+        Draw_Chat();
+        wnoutrefresh( s_chatMessages.win );
+    }
+    if( s_dirtyPanes & PANE_MEMBERS ) wnoutrefresh( s_memberList.win );
+    //Always last, the cursor ends up where the last window's is and it belongs in the message box.
+    wmove( s_messageBox.win, s_messageBox.cursorY, s_messageBox.cursorX );
+    wnoutrefresh( s_messageBox.win );
+    doupdate();
+    s_dirtyPanes = 0;
+    s_lastFrame = now;
+}
+
+int Frame_Timeout(){
+    if( !s_dirtyPanes ) return -1;
+    auto left = std::chrono::ceil<std::chrono::milliseconds>( s_lastFrame + s_frameInterval - std::chrono::steady_clock::now() );
+    return std::max<int>( left.count(), 0 );
+}
+
+void Clear_Chat(){
+    s_scrollback.clear();
+    s_chatTopEntry = s_chatTopLine = 0;
+    s_chatAtBottom = true;
+    s_dirtyPanes |= PANE_CHAT;
+}
+
+void Write_Room( std::string room ){
+    auto known = std::find( s_rooms.begin(), s_rooms.end(), room );
+    s_room = known - s_rooms.begin();
+    if( known == s_rooms.end() ) s_rooms.push_back( room );
+    //Goes on the border between the chat box and the message box.
+    int width = g_terminalWidth - 19;
+    std::string label = "#" + room + ( ( s_rooms.size() > 1 ) ? " (TAB to switch)" : "" );
+    attron(A_BOLD);
+    mvhline(g_terminalHeight - 5, 1, ACS_HLINE, width);
+    mvprintw(g_terminalHeight - 5, 2, " %.*s ", std::max( width - 4, 0 ), label.c_str());
+    attroff(A_BOLD);
+    s_dirtyPanes |= PANE_SCREEN;
 }
\ No newline at end of file
@@ -1,16 +1,15 @@
 //Handles printing and user input.
 #pragma once
 #include <string>
+#include <string_view>
 #include <ncurses.h>
 #include <vector>
 
 #define CONNECTED 0
 #define DISCONNECTED 1
 
-//Macro for wrapping cursor to the left when it exceeds the right border in a specific window.
-#define wrap_right(window) (( window.cursorX > window.width-1 ) ? (( window.cursorY+1 < window.height) ? ( window.cursorX = 0, window.cursorY++) : (window.cursorX--)) : 0)
-//Macro for wrapping cursor the right when it exceeds the left border in a specific window.
-#define wrap_left(window) (( window.cursorX < 0 ) ? (( window.cursorY >= 0) ? ( window.cursorX = window.width-1, window.cursorY--) : (window.cursorX++)) : 0)
+//Most frames a second the screen gets redrawn with, unless --fps says otherwise.
+#define DEFAULT_FPS 60
 
 struct Window{
     //NCurses WINDOW struct.
@@ -29,33 +28,54 @@ extern int g_terminalWidth, g_terminalHeight;
 //Initializes NCurses and sets it up.
 void Initialize_Screen();
 //Initializes the screen's subwindows (message box subwindow, member list subwindow and chat messages subwindow).
+//Once they're there it moves and resizes them instead, keeping what's in them.
 void Initialize_SubWindows(int messageX1, int messageY1, int messageX2, int messageY2,
                            int memberX1,  int memberY1  ,int memberX2 , int memberY2 ,
                            int chatX1  ,  int chatY1,    int chatX2,    int chatY2);
+//Gets the terminal's new size after a SIGWINCH and clears the screen, the subwindows have to be placed again and
+//the interface drawn again after it.
+void Resize_Screen();
 //Ends NCurses and frees memory.
 void End_Screen();
 //Draws the interface.
 void Draw_UI();
-//Increases MaxX's value on a specific line, if the current line is full it increases MaxX's value for the
-//MaxX's value for the next line, and if that line is full it increase MaxX's value for the line
-//below it...etc.
-void Increase_MaxX(int row, int width, int height);
-//Decreases MaxX's value on a specific line, if the current line is full it decrease MaX's
-//value for the next line if that line isn't empty.
-void Decrease_MaxX(int row, int width, int height);
-//Handle user input, this includes :
-// * Writing text for the message box, returns the text in it if ENTER is pressed.
+//Handle every key that's waiting, this includes :
+// * Writing text for the message box, returns the text in it if ENTER is pressed. The arrow keys, HOME and END
+//   move around in it, and it scrolls once there's more text than fits.
+// * Pasting, which goes in all at once. Newlines in it stay, so a paste of many lines is sent as one message.
 // * Pressing PgUP and PgDOWN to scroll the chat box.
+// * Pressing TAB to switch to the next room we've been in, it returns "/join <room>" like the user typed it.
 std::string Handle_Messages();
+//Did the last Handle_Messages() stop at a message with keys still waiting? ncurses might be holding on to more keys
+//that already left stdin, so the main loop shouldn't wait on stdin until it says no.
+bool Input_Pending();
+//Drawing only marks the panes it touched, this copies them all to the terminal at once with the cursor back in the
+//message box. Does nothing if nothing changed, or if the last frame went out less than a frame ago, then it all goes
+//out with the next one.
+void Render_Frame();
+//Milliseconds until Render_Frame() has something to draw, -1 if it doesn't.
+int Frame_Timeout();
+//Caps how many frames a second get drawn, 0 or less means one for every change.
+void Set_FrameRate( int fps );
 //Writes a member into a row in our member list.
-void Write_Member( short pair, int row, std::string memberName );
+void Write_Member( short pair, int row, std::string_view memberName );
 //Updates the member counter.
 void Update_MemberCount();
 //Inserts a member.
-void Insert_Member( short color, std::string memberName );
+void Insert_Member( short color, std::string_view memberName );
 //Finds and removes a member.
-void Remove_Member( std::string memberName );
+void Remove_Member( std::string_view memberName );
+//Removes every member.
+void Clear_Members();
 //Writes a chat message sent by the sender on the chat message window.
-void Write_Message( std::string message, std::string sender, short color );
+void Write_Message( std::string_view message, std::string_view sender, short color );
 //Writes the name of the new connected / disconnected user into the chat box.
-void Write_Connection( std::string name, int state );
\ No newline at end of file
+void Write_Connection( std::string_view name, int state );
+//Writes a notice (like losing the connection) into the chat box.
+void Write_Notice( std::string notice );
+//Throws out every message in the chat box, for when we go to another room.
+void Clear_Chat();
+//Shows the room we're in on the border above the message box, and remembers it for TAB.
+void Write_Room( std::string room );
+//Shows how the connection to the host is doing on the top border.
+void Write_Status( std::string status );
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "log.h"
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+//Where log lines go, null until OpenLog() is called.
+static FILE* s_log = nullptr;
+//Puts the terminal back before a fatal error exits.
+static void (*s_fatalHandler)() = nullptr;
+
+bool OpenLog( const char* path ){
+    if( !path ){
+        s_log = stderr;
+        return true;
+    }
+    FILE* file = fopen( path, "a" );
+    if( !file ) return false;
+    //Line buffered so a crash doesn't eat the last lines.
+    setvbuf( file, nullptr, _IOLBF, 0 );
+    if( s_log && s_log != stderr ) fclose( s_log );
+    s_log = file;
+    return true;
+}
+
+//Writes the line to file with the time in front. Workers log without holding any lock, so the whole line is put
+//together first and written with one call, stdio doesn't mix up lines written that way.
+static void WriteLine( FILE* file, const char* format, va_list arguments ){
+    char line[1024];
+    time_t now = time( nullptr );
+    tm local;
+    size_t length = strftime( line, sizeof(line), "[%Y-%m-%d %H:%M:%S] ", localtime_r( &now, &local ) );
+    va_list copy;
+    va_copy( copy, arguments );
+    int size = vsnprintf( line + length, sizeof(line) - length, format, copy );
+    va_end( copy );
+    if( size < 0 ) return;
+    //Too long for the one on the stack.
+    if( length + size + 1 >= sizeof(line) ){
+        std::string longLine( line, length );
+        longLine.resize( length + size + 1 );
+        vsnprintf( &longLine[length], size + 1, format, arguments );
+        longLine.back() = '\n';
+        fwrite( longLine.data(), 1, longLine.size(), file );
+        return;
+    }
+    length += size;
+    line[length++] = '\n';
+    fwrite( line, 1, length, file );
+}
+
+void Log( const char* format, ... ){
+    if( !s_log ) return;
+    va_list arguments;
+    va_start( arguments, format );
+    WriteLine( s_log, format, arguments );
+    va_end( arguments );
+}
+
+void SetFatalHandler( void (*handler)() ){
+    s_fatalHandler = handler;
+}
+
+void Fatal( const char* format, ... ){
+    if( s_fatalHandler ) s_fatalHandler();
+    va_list arguments;
+    va_start( arguments, format );
+    //Always tell whoever's looking at the terminal.
+    vfprintf( stderr, format, arguments );
+    fputc( '\n', stderr );
+    va_end( arguments );
+    //And keep it in the log file too.
+    if( s_log && s_log != stderr ){
+        va_start( arguments, format );
+        WriteLine( s_log, format, arguments );
+        va_end( arguments );
+    }
+    exit(1);
+}
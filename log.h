@@ -0,0 +1,13 @@
+//Logging and fatal errors, so the networking code never has to know if there's a terminal or not.
+//The UI registers End_Screen() as the fatal handler, a headless server doesn't have anything to put back.
+#pragma once
+
+//Where log lines go, nullptr means stderr. Returns false if the file can't be opened.
+//Nothing is logged until this is called, the UI would get scribbled over.
+bool OpenLog( const char* path );
+//Writes a line to the log, printf style, with the time in front.
+void Log( const char* format, ... ) __attribute__(( format( printf, 1, 2 ) ));
+//Called right before a fatal error exits, to put the terminal back.
+void SetFatalHandler( void (*handler)() );
+//Writes the error to stderr (and the log) and exits.
+[[noreturn]] void Fatal( const char* format, ... ) __attribute__(( format( printf, 1, 2 ) ));
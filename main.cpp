@@ -1,44 +1,138 @@
 #include "io.h"
 #include "sockets.h"
 #include "networking.h"
+#include "log.h"
+#include "bench.h"
 #include <csignal>
+#include <sys/signalfd.h>
+#include <cstring>
 
 #define COLOR_GRAY 8
 
 bool running = false;
+//Signals come in through this instead of interrupting whatever we're in the middle of,
+//so they wake the main loop up like everything else.
+static int s_signalfd = -1;
 
-//Cleans up everything in case SIGINT was called.
+//Cleans up everything in case SIGINT (or SIGTERM / SIGHUP) was called.
 void CleanUp( int signal ){
-    close( g_serverSocket.sockfd );
+    //Worker threads go first, their stats get added to ours.
+    if( g_host ) StopServer();
+    for( Socket& listener : g_serverSockets ) close( listener.sockfd );
     close( g_clientSocket.sockfd );
-    End_Screen();
+    if( !g_headless ) End_Screen();
+    else Log( "Shutting down." );
+    //Show how well sends and receives got batched together.
+    if( g_socketStats.sendCalls ){
+        printf("Sent %llu packets (%llu bytes) with %llu send calls, %.2f packets per call.\n",
+               g_socketStats.packetsSent, g_socketStats.bytesSent, g_socketStats.sendCalls,
+               (double) g_socketStats.packetsSent / g_socketStats.sendCalls);
+    }
+    if( g_socketStats.receiveCalls ){
+        printf("Received %llu packets with %llu receive calls, %.2f packets per call.\n",
+               g_socketStats.packetsReceived, g_socketStats.receiveCalls,
+               (double) g_socketStats.packetsReceived / g_socketStats.receiveCalls);
+    }
+    if( g_socketStats.submitCalls ){
+        printf("Handed them to io_uring with %llu submit calls.\n", g_socketStats.submitCalls);
+    }
     running = false;
     exit(0);
 }
 
-int main(int argc, char *argv[]){
-    //Initialize the screen.
-    Initialize_Screen();
-    //Initialize the screen's subwindows.
+//Blocks the signals we care about and has them come in through s_signalfd instead.
+//Has to be done before ncurses starts, or it puts it's own handlers on them.
+static void InitializeSignals(){
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    sigaddset( &signals, SIGHUP );
+    //The terminal was resized.
+    sigaddset( &signals, SIGWINCH );
+    sigprocmask( SIG_BLOCK, &signals, nullptr );
+    s_signalfd = signalfd( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC );
+    if( s_signalfd == -1 ) Fatal( "Couldn't create signal file descriptor : %s", strerror(errno) );
+}
+
+//Places the screen's subwindows for the terminal's size and draws the interface around them.
+static void Layout_Screen(){
     Initialize_SubWindows(1, g_terminalHeight-4, g_terminalWidth-18, g_terminalHeight-1,
                           g_terminalWidth - 17, 1, g_terminalWidth - 1, g_terminalHeight - 1,
-                          1, 1, g_terminalWidth - 19, g_terminalHeight -  6);
-
-    //Draws the UI.
+                          1, 1, g_terminalWidth - 18, g_terminalHeight - 5);
     Draw_UI();
+}
+
+//Waits for something to happen and cleans up if it was a signal.
+static void Wait( int timeout ){
+    //The terminal's gone, so it's the same as a hang up.
+    if( WaitForEvents( timeout, s_signalfd ) == RESULT_DISCONNECTED ) CleanUp( SIGHUP );
+    signalfd_siginfo signal;
+    if( read( s_signalfd, &signal, sizeof(signal) ) != sizeof(signal) ) return;
+    //Lay everything out again for the new size, headless servers don't care.
+    if( signal.ssi_signo == SIGWINCH ){
+        if( !g_headless ){
+            Resize_Screen();
+            Layout_Screen();
+        }
+    }
+    else CleanUp( signal.ssi_signo );
+}
+
+int main(int argc, char *argv[]){
+    //Headless servers don't touch the terminal at all, neither does the benchmark.
+    bool serve = false, bench = false;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp( argv[i], "--serve" ) ) serve = true;
+        if( !strcmp( argv[i], "--bench" ) ) bench = true;
+        //Most frames a second the UI gets drawn with.
+        if( !strcmp( argv[i], "--fps" ) && i + 1 < argc ) Set_FrameRate( atoi( argv[i+1] ) );
+    }
+    if( bench ){
+        OpenLog( nullptr );
+        return RunBenchmark( argc, argv );
+    }
+
+    //Run CleanUp() in case SIGINT was called. (^C)
+    InitializeSignals();
+
+    //Nowhere to log to but stderr, unless --log says otherwise.
+    if( serve ){
+        OpenLog( nullptr );
+        //Just the server, as fast as it can go.
+        InitializeNetwork(argc, argv);
+        running = true;
+        //There's nothing else to do, so wait on the sockets for as long as it takes.
+        while(running){
+            PollMessagesServer();
+            Wait(-1);
+        }
+        return 0;
+    }
+
+    //Initialize the screen.
+    Initialize_Screen();
+    //Initialize the screen's subwindows and draw the UI around them.
+    Layout_Screen();
+    //Put the terminal back before dying on a fatal error.
+    SetFatalHandler( End_Screen );
 
     //Initializes important network stuff.
     InitializeNetwork(argc, argv);
-    
-    //Run this in case SIGINT was called. (^C)
-    std::signal(SIGINT, CleanUp);
 
     running = true;
 
+    //Handle everything that's ready, then sleep until something else is.
     while(running){
         std::string message = Handle_Messages();
         PollMessagesClient(message);
         if( g_host ) PollMessagesServer();
+        //Don't sleep while ncurses might still have keys for us.
+        if( Input_Pending() ) continue;
+        //Everything drawn since the last frame goes out as one, at most so many times a second.
+        //If it's too soon for another, wake up once it isn't.
+        Render_Frame();
+        Wait( Frame_Timeout() );
     }
 
     End_Screen();
@@ -0,0 +1,81 @@
+//Lock-free queue that any amount of threads can push to and a single thread pops from.
+//Pushing is one atomic exchange, so producers never wait on each other or on the consumer.
+//It's a linked list where producers swap themselves in at the head and the consumer walks from the tail,
+//a stub node keeps the list from ever being empty so neither side has to deal with that case.
+//(Dmitry Vyukov's intrusive MPSC queue.)
+#pragma once
+#include <atomic>
+#include <utility>
+
+template<typename T>
+class MpscQueue{
+    public:
+        MpscQueue(){
+            head.store( &stub, std::memory_order_relaxed );
+            tail = &stub;
+        }
+        //Frees whatever was never popped.
+        ~MpscQueue(){
+            T value;
+            while( pop( value ) );
+        }
+        //Nodes point to each other, so no copying.
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        //Puts value on the queue, any thread can call it.
+        void push( T value ){
+            Node* node = new Node;
+            node->value = std::move( value );
+            pushNode( node );
+        }
+        //Takes the oldest value off the queue, only the consumer thread can call it.
+        //Returns false if it's empty, or if the only thing left is a push that isn't done yet
+        //(the producer is in the middle of linking it, it'll be there on the next try).
+        bool pop( T& value ){
+            Node* last = tail;
+            Node* next = last->next.load( std::memory_order_acquire );
+            //Skip the stub.
+            if( last == &stub ){
+                if( !next ) return false;
+                tail = next;
+                last = next;
+                next = next->next.load( std::memory_order_acquire );
+            }
+            if( next ) return take( last, next, value );
+            //last is the only node left, unless a producer is linking one right now.
+            if( last != head.load( std::memory_order_acquire ) ) return false;
+            //Put the stub back behind it so last can be taken off.
+            pushNode( &stub );
+            next = last->next.load( std::memory_order_acquire );
+            if( next ) return take( last, next, value );
+            return false;
+        }
+
+    private:
+        struct Node{
+            T value;
+            std::atomic<Node*> next{ nullptr };
+        };
+
+        void pushNode( Node* node ){
+            node->next.store( nullptr, std::memory_order_relaxed );
+            //Swap ourselves in as the newest node, then link the one we replaced to us.
+            Node* previous = head.exchange( node, std::memory_order_acq_rel );
+            previous->next.store( node, std::memory_order_release );
+        }
+        //Moves the value out of last, which next now replaces as the tail.
+        bool take( Node* last, Node* next, T& value ){
+            tail = next;
+            value = std::move( last->value );
+            delete last;
+            return true;
+        }
+
+        //Newest node, producers swap themselves in here.
+        std::atomic<Node*> head;
+        //Oldest node, only the consumer touches it.
+        Node* tail;
+        //Always in the list somewhere so it's never empty.
+        Node stub;
+};
@@ -0,0 +1,37 @@
+#include "names.h"
+
+NameTable g_names;
+
+uint32_t NameTable::intern( std::string_view name ){
+    auto found = ids.find( name );
+    if( found != ids.end() ){
+        uses[ found->second ]++;
+        return found->second;
+    }
+    uint32_t id;
+    if( !freeIds.empty() ){
+        id = freeIds.back();
+        freeIds.pop_back();
+        names[id] = name;
+    }
+    else{
+        id = names.size();
+        names.emplace_back( name );
+        uses.push_back( 0 );
+    }
+    uses[id] = 1;
+    ids[ names[id] ] = id;
+    return id;
+}
+
+void NameTable::release( uint32_t id ){
+    if( id == NO_NAME || --uses[id] ) return;
+    //The name stays in names until the number goes to another one, so views of it don't go bad right away.
+    ids.erase( names[id] );
+    freeIds.push_back( id );
+}
+
+uint32_t NameTable::find( std::string_view name ) const {
+    auto found = ids.find( name );
+    return ( found != ids.end() ) ? found->second : NO_NAME;
+}
@@ -0,0 +1,40 @@
+//Gives every member name a small number, so the server keeps a name once however many rooms and history messages
+//it's in, and clients speaking wire version 3 get sent the number instead of the name once they know it.
+//Every number is counted, it goes to another name once nothing uses it anymore.
+#pragma once
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//Number no name ever gets, a packet with it doesn't say who it's from.
+#define NO_NAME 0
+
+class NameTable{
+    public:
+        //Number of name, counting one more use of it. The numbers that were given back go out first.
+        uint32_t intern( std::string_view name );
+        //One use of a name less, once there's none left it's number can go to another name.
+        void release( uint32_t id );
+        //Number of name without counting a use, NO_NAME if it doesn't have one.
+        uint32_t find( std::string_view name ) const;
+        //Name with number id, it stays put until the number goes to another name.
+        std::string_view name( uint32_t id ) const { return names[id]; }
+        //Amount of names that have a number.
+        size_t size() const { return ids.size(); }
+
+    private:
+        //Names by number, a deque so they never move and the keys of ids can point into them.
+        std::deque< std::string > names = { "" };
+        //How many uses every number has.
+        std::vector< uint32_t > uses = { 0 };
+        //Numbers by name.
+        std::unordered_map< std::string_view, uint32_t > ids;
+        //Numbers nothing uses anymore.
+        std::vector< uint32_t > freeIds;
+};
+
+//Names of everyone in a room or a history on the server. (only used by the server, hold g_serverMutex.)
+extern NameTable g_names;
@@ -1,32 +1,534 @@
 #include "networking.h"
 #include "io.h"
 #include "sockets.h"
+#include "log.h"
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <chrono>
+#include <charconv>
+#include <map>
 
 //Globals, defined in networking.h
-Socket g_serverSocket, g_clientSocket;
+std::vector< Socket > g_serverSockets;
+Socket g_clientSocket;
 bool g_host = false;
-std::unordered_map<int, std::string> g_socktoName;
-std::unordered_map<int, Socket*> g_fdtoSock;
-std::vector<Socket> g_commVector;
-std::vector<Message> g_messageArchive;
-std::vector<std::string> g_memberList;
+bool g_headless = false;
+std::unordered_map< std::string, std::unique_ptr<Room> > g_rooms;
+std::vector< std::unique_ptr<Worker> > g_workers;
+std::mutex g_serverMutex;
 
 //Statics
-//fdSets for the server, only used when hosting.
-static fdSetGroup s_serverfdSets;
-//fdSets for the client, always used.
-static fdSetGroup s_clientfdSets;
+//Worker the current thread runs, the first one on the main thread.
+static thread_local Worker* s_worker = nullptr;
+//Worker the next accepted socket goes to.
+static size_t s_nextWorker = 0;
+//Set when the worker threads should stop.
+static std::atomic<bool> s_stopping{ false };
+//Socket stats of the worker threads that stopped.
+static SocketStats s_workerStats = {0};
+//Listening sockets that couldn't accept the last time, and when to try them again. Nothing else would tell us to,
+//the connections that are waiting already woke up the edge-triggered listener (or ended the ring's accept).
+//(first worker only.)
+static std::vector< Socket* > s_acceptPaused;
+static std::chrono::steady_clock::time_point s_acceptTime;
+//Did accepting fail since the last connection that got in? It's only logged the first time.
+static bool s_acceptFailing = false;
+//Number of the last broadcast made. (hold g_serverMutex.)
+static uint64_t s_broadcastSerial = 0;
+//What an io_uring completion was for, it's in the low bits of the user data with the connection pointer above them.
+#define RING_ACCEPT 0
+#define RING_RECEIVE 1
+#define RING_SEND 2
+#define RING_OPERATION_MASK 3
+//Gets everything broadcast without going through a socket, it's the host's UI when there is one.
+static void (*s_localMember)( const PacketView& packet ) = nullptr;
+//Room the host's UI is in. (hold g_serverMutex.)
+static Room* s_hostRoom = nullptr;
+//History limits every room gets.
+static size_t s_historyBytes = HISTORY_BYTES, s_historyMessages = HISTORY_MESSAGES;
+//Port to listen on or connect to.
+static int s_port = DEFAULT_PORT;
+//Where the server listens (--listen), every interface on s_port if it's empty.
+static std::vector< std::pair< std::string, int > > s_listen;
 //Name of the user, we'll use this soon.
 static std::string s_name;
+//Address of the host we joined, used for reconnecting.
+static std::string s_address;
+//Sequence number of the last message we got, a reconnect asks the server for everything after it.
+static uint64_t s_lastSequence = 0;
+//Where the connection to the host is at, one of the LINK_ values.
+static int s_link = LINK_WAITING;
+//Did we ever get in? Otherwise there's nothing to come back to.
+static bool s_joined = false;
+//Can we resume where we left off when we get it back? Only servers speaking version 2 know how.
+static bool s_resume = false;
+//Room we're in, a reconnect goes straight back to it.
+static std::string s_room = DEFAULT_ROOM;
+//Did the server put us in s_room yet? Getting told we're in the room we're already in is just a reconnect.
+static bool s_joinedRoom = false;
+//How long we wait between tries.
+static int s_reconnectDelay = RECONNECT_DELAY_MIN;
+//When the next try is while waiting, or when we give up on the one that's going while connecting.
+static std::chrono::steady_clock::time_point s_linkTime;
+//Server we relay for with --peer. Every join, leave and message here goes up to it and only what it sends back
+//down gets applied, so every server linked to it has the same members and sequence numbers.
+static std::string s_peerAddress;
+static int s_peerPort = DEFAULT_PORT;
+static bool s_relaying = false;
+//Our link to it on the first worker, null while it's down.
+static Connection* s_upstream = nullptr;
+//Socket of the link while it's connecting, where it's at, and when to try again / give up like the client's.
+static Socket s_upstreamSocket;
+static int s_upstreamLink = LINK_WAITING;
+static std::chrono::steady_clock::time_point s_upstreamTime;
+static int s_upstreamDelay = RECONNECT_DELAY_MIN;
+//Did it send us the state of every room yet? Nothing goes up before it did. (hold g_serverMutex.)
+static bool s_upstreamSynced = false;
+//Room the last ROOM_PACKET from it named.
+static Room* s_upstreamRoom = nullptr;
 
-int InitializeNetwork(int argc, char* argv[]){
-    //Reserve some space to lower amount of re-allocations.
-    g_commVector.reserve(2);
+//Which handler every packet type goes to, filled in at compile time instead of switching on the type.
+//Types without one are null, the packet gets ignored.
+template< typename Handler >
+struct HandlerTable{
+    Handler handlers[MAX_PACKET_TYPE + 1] = {};
+    constexpr HandlerTable( std::initializer_list< std::pair< int, Handler > > entries ){
+        for( const auto& entry : entries ) handlers[entry.first] = entry.second;
+    }
+    constexpr Handler operator[]( int type ) const { return ( type >= 0 && type <= MAX_PACKET_TYPE ) ? handlers[type] : nullptr; }
+};
+//Does what a packet that came in on a connection says.
+typedef void (*PacketHandler)( Connection* connection, const PacketView& packet );
+
+//Reads the number at the start of text like atoi() does, 0 if there isn't one. Received text isn't null-terminated.
+static int ParseNumber( std::string_view text ){
+    int number = 0;
+    std::from_chars( text.data(), text.data() + text.size(), number );
+    return number;
+}
+
+//Asks the current worker's io_uring to keep receiving on a connection, it's submitted when the tick is over.
+static void RingReceive( Connection* connection ){
+    s_worker->ring->receive( connection->socket.sockfd, (uint64_t) connection | RING_RECEIVE );
+    connection->ringOperations++;
+}
+
+//Hands as much of a connection's outbound queue as one sendmsg() takes to the current worker's io_uring,
+//unless it's already sending. It's submitted along with every other send when the tick is over.
+static void RingFlush( Connection* connection ){
+    RingSend& send = *connection->ringSend;
+    if( send.busy || !connection->socket.queued() ) return;
+    send.header = {0};
+    send.header.msg_iov = send.packets;
+    send.header.msg_iovlen = connection->socket.gather( send.packets, MAX_BATCHED_PACKETS );
+    s_worker->ring->sendmsg( connection->socket.sockfd, &send.header, (uint64_t) connection | RING_SEND );
+    send.busy = true;
+    connection->ringOperations++;
+    g_socketStats.sendCalls++;
+}
+
+//Hands a freshly accepted socket to the current worker's event loop and connections.
+static Connection* AddConnection( Socket& commSocket ){
+    std::unique_ptr<Connection> connection( new Connection );
+    //Move the socket to avoid copying.
+    connection->socket = std::move( commSocket );
+    connection->index = s_worker->connections.size();
+    //The ring does the receiving and hands us the bytes.
+    if( s_worker->ring ){
+        //Blocking like the ones the ring accepts, our link upstream was made non-blocking to connect.
+        connection->socket.setNonBlocking( false );
+        connection->socket.external = true;
+        connection->ringSend.reset( new RingSend );
+        RingReceive( connection.get() );
+    }
+    else{
+        //Never block on a single client.
+        connection->socket.setNonBlocking();
+        //Edge-triggered, we get told once when data arrives or the socket becomes writable again
+        //and then have to drain it / flush it ourselves.
+        s_worker->loop.add( connection->socket.sockfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, connection.get() );
+    }
+    s_worker->connections.push_back( std::move(connection) );
+    return s_worker->connections.back().get();
+}
+
+//Takes a connection off the current worker's event loop and connections.
+static void RemoveConnection( Connection* connection ){
+    std::vector< std::unique_ptr<Connection> >& connections = s_worker->connections;
+    //Shutting it down makes whatever the ring has going on it complete, so it can be freed.
+    if( s_worker->ring ) shutdown( connection->socket.sockfd, SHUT_RDWR );
+    else s_worker->loop.remove( connection->socket.sockfd );
+    connection->closed = true;
+    //Swap with the last connection and pop, order doesn't matter.
+    size_t index = connection->index;
+    std::swap( connections[index], connections.back() );
+    connections[index]->index = index;
+    s_worker->closedConnections.push_back( std::move( connections.back() ) );
+    connections.pop_back();
+}
+
+//Queues a frame on a connection, it gets sent when the tick is over.
+static void QueueFrame( Connection* connection, const Frame& frame ){
+    connection->socket.send( frame );
+    if( !connection->dirty ){
+        connection->dirty = true;
+        s_worker->dirtyConnections.push_back( connection );
+    }
+}
+
+//Queues a packet on a connection, it gets sent when the tick is over.
+static void QueuePacket( Connection* connection, const PacketView& packet ){
+    QueueFrame( connection, Socket::encode( packet, connection->socket.version ) );
+}
+
+//Puts item on worker's inbox and wakes it up, unless it's the current thread's worker which goes through
+//it's inbox before the tick is over anyway.
+static void SendToWorker( Worker* worker, WorkItem item ){
+    worker->inbox.push( std::move(item) );
+    if( worker != s_worker && !worker->woken.exchange( true ) ){
+        uint64_t one = 1;
+        write( worker->wakeupfd, &one, sizeof(one) );
+    }
+}
+
+//Encodes a packet for the relay link along with the ROOM_PACKET saying which room it's about, as one frame.
+static Frame RelayFrame( const Room* room, const PacketView& packet ){
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    Socket::encode( PacketView( ROOM_PACKET, room->name, "" ), WIRE_V2, *frame );
+    Socket::encode( packet, WIRE_V2, *frame );
+    return frame;
+}
+
+//Sends a packet about a room up to the server we relay for, through the first worker since it has the link.
+//Dropped while the link's down, the joins are told again once it's back. (hold g_serverMutex.)
+static void RelayUp( const Room* room, const PacketView& packet ){
+    if( !s_upstreamSynced ){
+        if( packet.header.packetType == MESSAGE_PACKET ){
+            Log( "Not linked to %s, dropped a message from %.*s.", s_peerAddress.c_str(), (int) packet.sender.size(), packet.sender.data() );
+        }
+        return;
+    }
+    WorkItem item;
+    item.relay = RelayFrame( room, packet );
+    SendToWorker( g_workers[0].get(), std::move(item) );
+}
+
+//Tells the clients in a room who's in it again after a SYNC_PACKET: a JOIN_PACKET for the room they're already in
+//clears their member list, then everyone's CONNECT_PACKET. Clients from before rooms can't clear it, so they don't get it.
+static Frame SyncFrame( const Room* room, int version ){
+    if( version == WIRE_V1 ) return nullptr;
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    Socket::encode( PacketView( JOIN_PACKET, room->name, "" ), version, *frame );
+    for( uint32_t member : room->members ) Socket::encode( PacketView( CONNECT_PACKET, "", g_names.name( member ), 0, member ), version, *frame );
+    return frame;
+}
 
-    //Clear all fd_sets for the client.
-    FD_ZERO( &s_clientfdSets.master );
-    FD_ZERO( &s_clientfdSets.readfds );
-    FD_ZERO( &s_clientfdSets.writefds );
+static void HandlePacket( const PacketView& packet );
+
+//Same thing for the host's UI.
+static void SyncHost( const Room* room ){
+    HandlePacket( PacketView( JOIN_PACKET, room->name, "" ) );
+    for( uint32_t member : room->members ){
+        std::string_view name = g_names.name( member );
+        Insert_Member( ( name == s_name ) ? COLOR_YELLOW : COLOR_WHITE, name );
+    }
+}
+
+//Is the member with number id in room? (hold g_serverMutex.)
+static bool IsMember( const Room* room, uint32_t id ){
+    return std::find( room->members.begin(), room->members.end(), id ) != room->members.end();
+}
+
+//Sends a packet to every connection in a room, and to the host's own UI if it's in there. It's encoded once per
+//wire version and every connection speaking that version queues the same frame. Only the workers that have someone
+//in the room get it, and every server relaying for us. Hold g_serverMutex, that's what keeps every worker getting
+//the broadcasts in the same order.
+static void Broadcast( Room* room, const PacketView& packet ){
+    int type = packet.header.packetType;
+    std::shared_ptr<BroadcastItem> item = std::make_shared<BroadcastItem>();
+    item->room = room;
+    item->type = type;
+    item->serial = ++s_broadcastSerial;
+    item->sequence = packet.header.sequence;
+    //Everyone in the room already knows the name of someone leaving or of someone in there saying something,
+    //so clients speaking version 3 only get the number.
+    PacketView numbered = packet;
+    uint32_t member = packet.header.member;
+    if( member && ( type == DISCONNECT_PACKET || ( type == MESSAGE_PACKET && IsMember( room, member ) ) ) ) numbered.sender = {};
+    for( int version = WIRE_V1; version <= WIRE_VERSION; version++ ){
+        if( !room->versionMembers[version] ) continue;
+        if( type == SYNC_PACKET ) item->frames[version] = SyncFrame( room, version );
+        else if( version >= WIRE_V3 ) item->frames[version] = Socket::encode( numbered, version );
+        //Numbers don't mean anything to clients from before version 2.
+        else if( type != RESUME_PACKET || version > WIRE_V1 ) item->frames[version] = Socket::encode( packet, version );
+    }
+    bool peers = false;
+    for( auto& worker : g_workers ) peers = peers || !worker->peers.empty();
+    if( peers ) item->relayFrame = RelayFrame( room, packet );
+    for( auto& worker : g_workers ){
+        if( room->workerMembers[ worker->index ] || !worker->peers.empty() ) SendToWorker( worker.get(), { item } );
+    }
+    //And to the host's own UI, it's in the same process so it just gets called.
+    if( s_localMember && room == s_hostRoom ){
+        if( type == SYNC_PACKET ) SyncHost( room );
+        else s_localMember( packet );
+    }
+}
+
+//Queues a broadcast on every connection of the current worker in it's room that should get it,
+//and on every server relaying for us.
+static void DeliverBroadcast( const BroadcastItem& item ){
+    if( item.relayFrame ){
+        for( Connection* peer : s_worker->peers ){
+            //It got the state of every room after this was made.
+            if( item.serial <= peer->joinedSerial ) continue;
+            //Anything else waits until it has the history.
+            if( peer->catchingUp ) peer->heldFrames.push_back( item.relayFrame );
+            else QueueFrame( peer, item.relayFrame );
+        }
+    }
+    auto members = s_worker->roomConnections.find( item.room );
+    if( members == s_worker->roomConnections.end() ) return;
+    for( Connection* connection : members->second ){
+        //It got the member list and history after this was made.
+        if( item.serial <= connection->joinedSerial ) continue;
+        //The room's numbers started over, everything from now on is new.
+        if( item.type == RESUME_PACKET ) connection->historyEnd = 0;
+        //Messages are in the history, so a client catching up gets them from there.
+        if( item.type == MESSAGE_PACKET && ( connection->historySequence || item.sequence < connection->historyEnd ) ) continue;
+        const Frame& frame = item.frames[ connection->socket.version ];
+        if( !frame ) continue;
+        //Anything else waits until it's caught up.
+        if( connection->historySequence ) connection->heldFrames.push_back( frame );
+        else QueueFrame( connection, frame );
+    }
+}
+
+//Goes through everything put on the current worker's inbox.
+static void DrainInbox(){
+    //Anything put on it after this wakes us up again.
+    s_worker->woken.store( false );
+    WorkItem item;
+    while( s_worker->inbox.pop( item ) ){
+        if( item.broadcast ) DeliverBroadcast( *item.broadcast );
+        //Goes up to the server we relay for, unless the link went down since.
+        else if( item.relay ){
+            if( s_upstream ) QueueFrame( s_upstream, item.relay );
+        }
+        //A socket the first worker accepted for us.
+        else{
+            Socket commSocket( item.fd );
+            AddConnection( commSocket );
+        }
+    }
+}
+
+//Throws out a room's cached history chunks that had messages thrown out of the history. It's done as soon as the
+//history throws them out, so the chunks never hold more than what's still in there. (hold g_serverMutex.)
+static void PruneChunks( Room* room ){
+    for( auto& chunks : room->historyChunks ) chunks.erase( chunks.begin(), chunks.lower_bound( room->history.firstSequence() ) );
+}
+
+//Puts a message on a room's history, which gives it it's sequence number, and broadcasts it there.
+//When we relay for another server it goes up to that one instead, we put it on the history once it comes back down.
+//The history keeps a copy of it, the packet itself can point into a receive buffer.
+static void PostMessage( Room* room, PacketView packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    if( s_relaying ){
+        RelayUp( room, packet );
+        return;
+    }
+    History& history = room->history;
+    packet.header.sequence = history.add( packet.message, packet.sender );
+    packet.header.member = history.senderId( history.size() - 1 );
+    PruneChunks( room );
+    Broadcast( room, packet );
+}
+
+//Puts someone on a room's member list and tells everyone in there. (hold g_serverMutex.)
+static void MemberJoined( Room* room, std::string_view name ){
+    uint32_t id = g_names.intern( name );
+    room->members.push_back( id );
+    Broadcast( room, PacketView( CONNECT_PACKET, "", name, 0, id ) );
+}
+
+//Takes someone off a room's member list and tells everyone left in there. (hold g_serverMutex.)
+static void MemberLeft( Room* room, std::string_view name ){
+    uint32_t id = g_names.find( name );
+    auto member = std::find( room->members.begin(), room->members.end(), id );
+    if( id == NO_NAME || member == room->members.end() ){
+        Broadcast( room, PacketView( DISCONNECT_PACKET, "", name ) );
+        return;
+    }
+    room->members.erase( member );
+    Broadcast( room, PacketView( DISCONNECT_PACKET, "", name, 0, id ) );
+    //Only once it's been said, name might be the one g_names keeps.
+    g_names.release( id );
+}
+
+//Someone here (or on a server relaying for us) joined a room. When we relay for another server it's told instead,
+//it's the one that puts them on the member list. (hold g_serverMutex.)
+static void AddMember( Room* room, std::string_view name ){
+    room->localMembers.push_back( g_names.intern( name ) );
+    if( s_relaying ) RelayUp( room, PacketView( CONNECT_PACKET, "", name ) );
+    else MemberJoined( room, name );
+}
+
+//Someone here (or on a server relaying for us) left a room. (hold g_serverMutex.)
+static void RemoveMember( Room* room, std::string_view name ){
+    uint32_t id = g_names.find( name );
+    auto member = std::find( room->localMembers.begin(), room->localMembers.end(), id );
+    bool local = ( id != NO_NAME && member != room->localMembers.end() );
+    if( local ) room->localMembers.erase( member );
+    if( s_relaying ) RelayUp( room, PacketView( DISCONNECT_PACKET, "", name ) );
+    else MemberLeft( room, name );
+    if( local ) g_names.release( id );
+}
+
+//Room names are short and printable without spaces, so they fit anywhere they're shown.
+static bool ValidRoomName( std::string_view name ){
+    if( name.empty() || name.size() > MAX_ROOM_NAME ) return false;
+    for( char c : name ) if( c <= ' ' || c > '~' ) return false;
+    return true;
+}
+
+//Finds a room, making it if it doesn't exist yet. Returns nullptr if the name's no good or there's too many rooms.
+//(hold g_serverMutex.)
+static Room* GetRoom( std::string_view name ){
+    auto found = g_rooms.find( std::string( name ) );
+    if( found != g_rooms.end() ) return found->second.get();
+    if( !ValidRoomName( name ) || g_rooms.size() >= MAX_ROOMS ) return nullptr;
+    std::unique_ptr<Room> room( new Room );
+    room->name = name;
+    room->history.setLimits( s_historyBytes, s_historyMessages );
+    room->workerMembers.assign( g_workers.size(), 0 );
+    Room* made = room.get();
+    g_rooms[made->name] = std::move( room );
+    return made;
+}
+
+//Flushes every connection that had something queued this tick.
+static void FlushConnections(){
+    for( Connection* connection : s_worker->dirtyConnections ){
+        connection->dirty = false;
+        if( connection->closed ) continue;
+        if( s_worker->ring ) RingFlush( connection );
+        else connection->socket.flush();
+    }
+    s_worker->dirtyConnections.clear();
+}
+
+//Turns a size like "512", "64K", "8M" or "1G" into a number.
+static size_t ParseSize( const char* size ){
+    char* suffix;
+    size_t value = strtoull( size, &suffix, 10 );
+    switch( *suffix ){
+        case 'G': case 'g': value *= 1024;
+        [[fallthrough]];
+        case 'M': case 'm': value *= 1024;
+        [[fallthrough]];
+        case 'K': case 'k': value *= 1024;
+    }
+    return value;
+}
+
+void SplitEndpoint( std::string& address, int& port ){
+    if( !address.compare( 0, strlen(UNIX_PREFIX), UNIX_PREFIX ) ) return;
+    if( address[0] == '[' ){
+        size_t close = address.find( ']' );
+        if( close == std::string::npos ) return;
+        if( address.compare( close + 1, 1, ":" ) == 0 ) port = atoi( address.c_str() + close + 2 );
+        address = address.substr( 1, close - 1 );
+        return;
+    }
+    size_t colon = address.find( ':' );
+    if( colon == std::string::npos || address.find( ':', colon + 1 ) != std::string::npos ) return;
+    port = atoi( address.c_str() + colon + 1 );
+    address.erase( colon );
+}
+
+//Creates the listening server sockets.
+static void StartServer(){
+    if( s_listen.empty() ) s_listen.push_back( { "", s_port } );
+    for( auto& endpoint : s_listen ){
+        if( !endpoint.second ) endpoint.second = s_port;
+        g_serverSockets.push_back( Socket( SERVER, SOCK_STREAM, endpoint.second, endpoint.first.c_str() ) );
+        //Written the way --listen takes it.
+        std::string name = endpoint.first;
+        if( name.compare( 0, strlen(UNIX_PREFIX), UNIX_PREFIX ) ){
+            if( name.empty() ) name = "*";
+            else if( name.find( ':' ) != std::string::npos ) name = "[" + name + "]";
+            name += ":" + std::to_string( endpoint.second );
+        }
+        Log( "Listening on %s.", name.c_str() );
+    }
+    //Yes, current user is a host.
+    g_host = true;
+}
+
+//Is data what the event loop hands back for one of the listening sockets? It's the socket.
+static Socket* Listener( void* data ){
+    for( Socket& socket : g_serverSockets ) if( data == &socket ) return &socket;
+    return nullptr;
+}
+
+static void RunWorker( Worker* worker );
+
+//Creates the server's workers, the first one is run by the main thread and owns the listening socket.
+//With useRing they get an io_uring each, unless the kernel can't, then it's epoll like always.
+//Returns whether they got one.
+static bool StartWorkers( int amount, bool useRing ){
+    for( int i = 0; i < amount; i++ ){
+        std::unique_ptr<Worker> worker( new Worker );
+        //Other workers write to it when they put something on the inbox.
+        worker->wakeupfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if( worker->wakeupfd == ERR ) Fatal( "Couldn't create worker wakeup file descriptor : %s", strerror(errno) );
+        //A pointer to the worker means it's wakeup file descriptor.
+        worker->loop.add( worker->wakeupfd, EPOLLIN, worker.get() );
+        worker->index = i;
+        if( useRing ){
+            std::unique_ptr<IoRing> ring( new IoRing );
+            if( ring->setup() ){
+                //A pointer to the ring means it has completions. Level-triggered, so whatever's left
+                //over from a tick wakes us right back up.
+                worker->loop.add( ring->fd, EPOLLIN, ring.get() );
+                worker->ring = std::move( ring );
+            }
+            else{
+                Log( "io_uring isn't usable here (%s), using epoll.", strerror(errno) );
+                useRing = false;
+            }
+        }
+        g_workers.push_back( std::move(worker) );
+    }
+    s_worker = g_workers[0].get();
+    for( Socket& listener : g_serverSockets ){
+        //One multishot accept covers every connection from now on.
+        if( s_worker->ring ) s_worker->ring->accept( listener.sockfd, (uint64_t) &listener | RING_ACCEPT );
+        else{
+            //From now on accept() is only called when the event loop says there's someone waiting,
+            //and it's edge-triggered so we accept until there's nobody left.
+            listener.setNonBlocking();
+            //A pointer to a listening socket means that's what it is.
+            s_worker->loop.add( listener.sockfd, EPOLLIN | EPOLLET, &listener );
+        }
+    }
+    //Only start the threads once every worker exists, they send to each other.
+    for( int i = 1; i < amount; i++ ) g_workers[i]->thread = std::thread( RunWorker, g_workers[i].get() );
+    return useRing;
+}
+
+static int UpdateConnection();
+static void HostJoin( const std::string& name );
+
+int InitializeNetwork(int argc, char* argv[]){
+    //Are we hosting? The server starts once every argument is read, --port might come after.
+    bool host = false;
+    //Amount of server workers.
+    int workers = 1;
+    //Should the server use io_uring instead of epoll?
+    bool useRing = false;
 
     //There are no command-line arguments or there is only the --name command line argument.
     if( argc == 1 || argc == 2 && !strcmp(argv[1], "--name")){
@@ -39,32 +541,72 @@ int InitializeNetwork(int argc, char* argv[]){
     for( int i = 1; i < argc; i++ ){
         //We're hosting!
         if( !strcmp( argv[i], "--host") ){
-            //Creates the listening server socket.
-            g_serverSocket = Socket( SERVER, SOCK_STREAM, 6969 );
-            g_fdtoSock[ g_serverSocket.sockfd ] = &g_serverSocket;
-            //Creates the client socket( the one that'll send / receive on our end ).
-            g_clientSocket = Socket( CLIENT, SOCK_STREAM, 6969);
-            g_fdtoSock[ g_clientSocket.sockfd ] = &g_clientSocket;
-            //Communication socket.
-            Socket commSocket;
-            //Get file descriptor of the socket.
-            if( g_serverSocket.accept( commSocket ) == RESULT_OK){
-                g_fdtoSock[ commSocket.sockfd ] = &commSocket;
-                //Move the socket to avoid copying.
-                g_commVector.push_back( std::move( commSocket ) );
-            }
-            //Yes, current user is a host.
-            g_host = true;
+            host = true;
+        }
+        //We're only hosting, no terminal and no client.
+        else if( !strcmp( argv[i], "--serve") ){
+            host = true;
+            g_headless = true;
+        }
+        //Port to host on or to join on.
+        else if( !strcmp( argv[i], "--port") && i + 1 < argc ){
+            s_port = atoi( argv[i+1] );
+            i++;
+        }
+        //Room to start in.
+        else if( !strcmp( argv[i], "--room") && i + 1 < argc ){
+            if( ValidRoomName( argv[i+1] ) ) s_room = argv[i+1];
+            i++;
+        }
+        //Where the log goes.
+        else if( !strcmp( argv[i], "--log") && i + 1 < argc ){
+            if( !OpenLog( argv[i+1] ) ) Fatal( "Couldn't open log file %s : %s", argv[i+1], strerror(errno) );
+            i++;
+        }
+        //Where to listen, as address:port, [IPv6 address]:port, :port or a Unix domain socket. Can be given many times.
+        else if( !strcmp( argv[i], "--listen") && i + 1 < argc ){
+            //Port 0 means it didn't say, it gets --port's once they're all read.
+            std::pair< std::string, int > endpoint = { argv[i+1], 0 };
+            SplitEndpoint( endpoint.first, endpoint.second );
+            s_listen.push_back( endpoint );
+            i++;
         }
         //We're joining!
         else if( !strcmp( argv[i], "--join") ){
-            //Extract the address.
-            std::string address(argv[i+1]);
-            //Creates socket with the address and port "6969" (nice).
-            g_clientSocket = Socket( CLIENT, SOCK_STREAM, 6969, address.c_str());
+            //Extract the address, we connect to it on port "6969" (nice, unless --port or the address says otherwise)
+            //once everything's up.
+            s_address = std::string(argv[i+1]);
+            int port = 0;
+            SplitEndpoint( s_address, port );
+            if( port ) s_port = port;
             //Skips next command-line argument because we have already processed it.
             i++;
         }
+        //Most bytes of text the history keeps.
+        else if( !strcmp( argv[i], "--history-bytes") && i + 1 < argc ){
+            s_historyBytes = ParseSize( argv[i+1] );
+            i++;
+        }
+        //Most messages the history keeps.
+        else if( !strcmp( argv[i], "--history-messages") && i + 1 < argc ){
+            s_historyMessages = ParseSize( argv[i+1] );
+            i++;
+        }
+        //Amount of workers the server spreads it's connections over.
+        else if( !strcmp( argv[i], "--workers") && i + 1 < argc ){
+            workers = std::max( 1, std::min( atoi( argv[i+1] ), MAX_WORKERS ) );
+            i++;
+        }
+        //Server to relay for, the address can have a port like --listen's.
+        else if( !strcmp( argv[i], "--peer") && i + 1 < argc ){
+            s_peerAddress = argv[i+1];
+            SplitEndpoint( s_peerAddress, s_peerPort );
+            i++;
+        }
+        //io_uring for the server's sockets, if the kernel has what it takes.
+        else if( !strcmp( argv[i], "--io-uring") ){
+            useRing = true;
+        }
         //Name.
         else if( !strcmp( argv[i], "--name") ){
             //Say my name...
@@ -78,204 +620,1092 @@ int InitializeNetwork(int argc, char* argv[]){
         s_name = "Mingebag";
     }
 
-    //Put the name on the table.
-    g_socktoName[ g_clientSocket.sockfd ] = s_name;
+    if( host ){
+        StartServer();
+        //Every connection is a file descriptor, so let the host have as many as it's allowed to.
+        rlimit limit;
+        if( getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < limit.rlim_max ){
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit( RLIMIT_NOFILE, &limit );
+        }
+        //The host's UI isn't thread safe, and it gets called by whichever worker broadcasts.
+        if( !g_headless && workers > 1 ){
+            workers = 1;
+            Log( "--workers only works with --serve, using 1." );
+        }
+        useRing = StartWorkers( workers, useRing );
+        //Everyone ends up in the default room sooner or later.
+        GetRoom( DEFAULT_ROOM );
+        Log( "Running %d worker(s) using %s, every room's history keeps %zu bytes / %zu messages.",
+             workers, useRing ? "io_uring" : "epoll", s_historyBytes, s_historyMessages );
+        //Link up with the server we relay for right away, the first worker keeps the link going from then on.
+        if( !s_peerAddress.empty() ){
+            s_relaying = true;
+            s_upstreamTime = std::chrono::steady_clock::now();
+            Log( "Relaying for %s:%d.", s_peerAddress.c_str(), s_peerPort );
+        }
+    }
+    else if( !s_peerAddress.empty() ) Log( "--peer only works with --host or --serve." );
+
+    //Nothing else to set up without a client.
+    if( g_headless ) return RESULT_OK;
 
-    //Initialize server's fd_sets, put the server socket and communication socket on the master set.
-    //Make the maxfd the bigger socket file descriptor.
+    //The host takes part straight from the server, without a socket.
     if( g_host ){
-        FD_ZERO( &s_serverfdSets.master );
-        FD_ZERO( &s_serverfdSets.readfds );
-        FD_ZERO( &s_serverfdSets.writefds );
+        s_localMember = HandlePacket;
+        {
+            std::lock_guard<std::mutex> lock( g_serverMutex );
+            //Put the name on the member list, before we're in there so we don't see our own hello.
+            AddMember( GetRoom( DEFAULT_ROOM ), s_name );
+            s_hostRoom = GetRoom( DEFAULT_ROOM );
+            s_joinedRoom = true;
+        }
+        //Host gets special treatement!
+        Insert_Member( COLOR_YELLOW, s_name );
+        Write_Status( "Hosting on port " + std::to_string( s_port ) );
+        Write_Room( s_hostRoom->name );
+        //--room works for the host too.
+        if( s_room != DEFAULT_ROOM ) HostJoin( s_room );
+        return RESULT_OK;
+    }
+
+    //Start connecting right away, the UI keeps going while it does.
+    g_clientSocket = Socket( -1, CLIENT );
+    Write_Room( s_room );
+    s_link = LINK_WAITING;
+    s_linkTime = std::chrono::steady_clock::now();
+    UpdateConnection();
+
+    return RESULT_OK;
+}
+
+//Waits a while before trying to connect again, every failed try doubles the wait.
+static void RetryLater( const char* reason ){
+    s_link = LINK_WAITING;
+    s_linkTime = std::chrono::steady_clock::now() + std::chrono::milliseconds( s_reconnectDelay );
+    Write_Status( std::string(reason) + ", trying again in " + std::to_string( ( s_reconnectDelay + 999 ) / 1000 ) + "s" );
+    //There's no point hammering a host that's down.
+    s_reconnectDelay = std::min( s_reconnectDelay * 2, RECONNECT_DELAY_MAX );
+}
 
-        FD_SET( g_serverSocket.sockfd, &s_serverfdSets.master );
-        FD_SET( g_commVector.at(0).sockfd, &s_serverfdSets.master );
-        s_serverfdSets.maxfd = std::max( g_serverSocket.sockfd, g_commVector.at(0).sockfd );
+//The connection to the host went through, introduce ourselves.
+static void Connected(){
+    s_link = LINK_CONNECTED;
+    s_reconnectDelay = RECONNECT_DELAY_MIN;
+
+    //The newest wire version we speak and the room we want to be in. Servers from before rooms only read the version.
+    std::string hello = std::to_string(WIRE_VERSION) + " " + s_room;
+    //Ask for whatever we missed, the sequence number only fits in a version 2 header.
+    if( s_resume ){
+        g_clientSocket.version = WIRE_V2;
+        g_clientSocket.send( PacketView( RESUME_PACKET, hello, s_name, s_lastSequence ) );
     }
+    //Tell the server who we are.
+    else g_clientSocket.send( PacketView( CONNECT_PACKET, hello, s_name ) );
+    g_clientSocket.flush();
 
-    //Client socket master list must only have the client socket.
-    FD_SET( g_clientSocket.sockfd, &s_clientfdSets.master );
-    //There's only one file descriptor anyways...
-    s_clientfdSets.maxfd = g_clientSocket.sockfd;
+    if( s_joined ) Write_Notice( "Reconnected!" );
+    s_joined = true;
+    Write_Status( "Connected to " + s_address );
+}
 
-    //We don't really need to send anything as a client if we are hosting.
-    if( g_host ) {
-        //Put the name on the member list.
-        g_memberList.push_back( s_name );
-        //Host gets special treatement!
-        Insert_Member( (g_host) ? COLOR_YELLOW : COLOR_WHITE, s_name );
+//Moves the connection to the host along without ever waiting on it: starts connecting when it's time to try,
+//and checks on a connect that's going. Returns RESULT_OK once we're connected.
+static int UpdateConnection(){
+    auto now = std::chrono::steady_clock::now();
+    if( s_link == LINK_WAITING ){
+        //Not time yet.
+        if( now < s_linkTime ) return RESULT_SLEEP;
+        int result = g_clientSocket.connect( s_port, s_address.c_str() );
+        if( result == RESULT_ERROR ){
+            RetryLater( strerror(errno) );
+            return RESULT_SLEEP;
+        }
+        s_link = LINK_CONNECTING;
+        s_linkTime = now + std::chrono::milliseconds( CONNECT_TIMEOUT );
+        Write_Status( "Connecting to " + s_address + "..." );
+        if( result == RESULT_OK ) Connected();
+    }
+    else if( s_link == LINK_CONNECTING ){
+        int result = g_clientSocket.connected();
+        if( result == RESULT_OK ) Connected();
+        else if( result == RESULT_ERROR ) RetryLater( strerror(errno) );
+        //The host isn't answering at all.
+        else if( now >= s_linkTime ) RetryLater( "Timed out" );
     }
-    else SendMessage( CONNECT_PACKET , g_clientSocket, {"", s_name });
+    return ( s_link == LINK_CONNECTED ) ? RESULT_OK : RESULT_SLEEP;
+}
 
-    return RESULT_OK;
+//What the packets from the server do, whether they came over our client socket or straight from our own server.
+//Someone joined the room.
+static void ShowConnect( const PacketView& packet ){
+    Insert_Member( COLOR_WHITE, packet.sender );
+    Write_Connection( packet.sender, CONNECTED );
 }
 
-int SendMessage( int type, Socket& socket, Message message ){
-    Packet sentMessage = {0};
+static void ShowMessage( const PacketView& packet ){
+    //Already got this one before the connection dropped.
+    if( packet.header.sequence ){
+        if( packet.header.sequence <= s_lastSequence ) return;
+        s_lastSequence = packet.header.sequence;
+    }
+    Write_Message( packet.message, packet.sender, COLOR_WHITE );
+}
 
-    //Turns the message into a sendable packet.
-    sentMessage.header.packetType = type;
-    sentMessage.header.messageSize = message.message.size();
-    sentMessage.header.nameSize = message.sender.size();
-    sentMessage.message = message.message;
-    sentMessage.sender = message.sender;
-    
-    //Send packet!
-    return socket.send(sentMessage);
+//Someone left the room.
+static void ShowDisconnect( const PacketView& packet ){
+    Remove_Member( packet.sender );
+    Write_Connection( packet.sender, DISCONNECTED );
 }
 
-int ReceiveMessage( Socket& socket, Message& message ){
-    Packet receivedPacket = {0};
-    //Receives packet.
-    int status = socket.receive(receivedPacket);
-    //Socket reception went well.
-    if( status == RESULT_OK || status == RESULT_DISCONNECTED ){
-        message.message = receivedPacket.message;
-        message.sender = receivedPacket.sender;
-        //Returns the packet type.
-        return (status == RESULT_DISCONNECTED) ? RESULT_DISCONNECTED : receivedPacket.header.packetType;
+//The server agreed on a wire version, send with it from now on.
+static void UseVersion( const PacketView& packet ){
+    int version = ParseNumber( packet.message );
+    if( version >= WIRE_V1 && version <= WIRE_VERSION ) g_clientSocket.version = version;
+}
+
+//Names of the numbers the server gave us, it leaves the names out once we know them. (wire version 3.)
+static std::unordered_map< uint32_t, std::string > s_memberNames;
+
+//We're in a room, the member list and history come next. Coming back to the same room after a reconnect
+//keeps what's on the screen, the server only sends what we missed.
+static void EnterRoom( const PacketView& packet ){
+    Clear_Members();
+    //The numbers are said again with the member list and history.
+    s_memberNames.clear();
+    if( packet.message == s_room && s_joinedRoom ) return;
+    s_room = packet.message;
+    s_joinedRoom = true;
+    s_lastSequence = 0;
+    Clear_Chat();
+    Write_Room( s_room );
+    Write_Notice( "You're in #" + s_room );
+}
+
+//The server says where the messages it's sending start.
+static void Resume( const PacketView& packet ){
+    //Some were thrown out of the history before we got back.
+    if( packet.header.sequence > s_lastSequence + 1 ){
+        Write_Notice( "Some messages were missed while disconnected." );
+    }
+    s_lastSequence = packet.header.sequence - 1;
+}
+
+static constexpr HandlerTable< void (*)( const PacketView& ) > c_uiHandlers = {
+    { CONNECT_PACKET, ShowConnect },
+    { MESSAGE_PACKET, ShowMessage },
+    { DISCONNECT_PACKET, ShowDisconnect },
+    { VERSION_PACKET, UseVersion },
+    { JOIN_PACKET, EnterRoom },
+    { RESUME_PACKET, Resume },
+};
+
+//Does what a packet from the server says. A numbered packet with a name says who the number is, one without
+//gets the name we were told before.
+static void HandlePacket( const PacketView& packet ){
+    auto handler = c_uiHandlers[ packet.header.packetType ];
+    if( !handler ) return;
+    if( packet.header.member == NO_NAME ) return handler( packet );
+    if( !packet.sender.empty() ){
+        s_memberNames[ packet.header.member ] = packet.sender;
+        return handler( packet );
     }
-    //Something wrong happened..
-    return status;
+    auto name = s_memberNames.find( packet.header.member );
+    //Never told, there's no telling who it's from.
+    if( name == s_memberNames.end() ){
+        Log( "Got a packet from member %u, nobody said who that is.", packet.header.member );
+        return;
+    }
+    PacketView named = packet;
+    named.sender = name->second;
+    handler( named );
+}
+
+//Moves the host's UI to another room, it's told the same things a client would be.
+static void HostJoin( const std::string& name ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    Room* room = GetRoom( name );
+    if( !room ){
+        Write_Notice( "Can't make any more rooms." );
+        return;
+    }
+    if( room == s_hostRoom ) return;
+    //Out of the old one, without seeing our own goodbye.
+    Room* old = s_hostRoom;
+    s_hostRoom = nullptr;
+    RemoveMember( old, s_name );
+
+    HandlePacket( PacketView( JOIN_PACKET, room->name, "" ) );
+    for( uint32_t member : room->members ) Insert_Member( COLOR_WHITE, g_names.name( member ) );
+    Insert_Member( COLOR_YELLOW, s_name );
+    //The newest of the history, the chat box doesn't hold much more than that anyway.
+    History& history = room->history;
+    size_t first = ( history.size() > HOST_HISTORY_MESSAGES ) ? history.size() - HOST_HISTORY_MESSAGES : 0;
+    for( size_t index = first; index < history.size(); index++ ){
+        HandlePacket( PacketView( MESSAGE_PACKET, history.message(index), history.sender(index), history.sequence(index) ) );
+    }
+    AddMember( room, s_name );
+    s_hostRoom = room;
+}
+
+//Handles what the user typed if it's a command like "/join room" or "/part", returns false if it isn't one.
+static bool RoomCommand( const std::string& message ){
+    std::string room;
+    if( message.compare( 0, 6, "/join " ) == 0 ) room = message.substr( 6 );
+    else if( message == "/part" ) room = DEFAULT_ROOM;
+    else if( message == "/join" ) room = "";
+    else return false;
+    if( !ValidRoomName( room ) ){
+        Write_Notice( "Usage: /join <room>, room names have no spaces and are at most " + std::to_string( MAX_ROOM_NAME ) + " long" );
+        return true;
+    }
+    if( g_host ) HostJoin( room );
+    else if( s_link != LINK_CONNECTED ) Write_Notice( "Not connected, can't switch rooms." );
+    else{
+        //The server answers with a JOIN_PACKET once we're in.
+        if( room == DEFAULT_ROOM ) g_clientSocket.send( PacketView( PART_PACKET, "", s_name ) );
+        else g_clientSocket.send( PacketView( JOIN_PACKET, room, s_name ) );
+        g_clientSocket.flush();
+    }
+    return true;
 }
 
 int PollMessagesClient(std::string& message){
-    //select() overrides it's arguments and we don't want that, so we copy.
-    s_clientfdSets.readfds = s_clientfdSets.master;
-    s_clientfdSets.writefds = s_clientfdSets.master;
-
-    //timeval of 0 seconds make select() non blocking.
-    struct timeval timeout = {0, 0};
-
-    //Monitors active socket file descriptors and checks if they are ready to read / write.
-    int ready = select( s_clientfdSets.maxfd + 1, &s_clientfdSets.readfds, &s_clientfdSets.writefds, nullptr, &timeout );
-    //There's nothing, so skip. 
-    if( ready == 0 ){
-        return RESULT_SLEEP;
-    }
-    //There's an error creeping around here!
-    else if( ready == ERR ){
-        return RESULT_ERROR;
-    }
-
-    //Now we're talking!
-    //Socket wants to read ( aka recv() ).
-    if( FD_ISSET( g_clientSocket.sockfd, &s_clientfdSets.readfds ) ){
-        Message receivedMessage;
-
-        int packet = ReceiveMessage(g_clientSocket, receivedMessage);
-        switch( packet ){
-            case CONNECT_PACKET :
-                Insert_Member(COLOR_WHITE, receivedMessage.sender);
-                Write_Connection(receivedMessage.sender, CONNECTED );
-                break;
-            case MESSAGE_PACKET :
-                Write_Message( receivedMessage.message, receivedMessage.sender, COLOR_WHITE);
-                break;
-            case DISCONNECT_PACKET:
-                Remove_Member( receivedMessage.sender );
-                Write_Connection(receivedMessage.sender, DISCONNECTED );
-                break;
+    if( message != "" && RoomCommand( message ) ) message.clear();
+
+    //We're the server, so there's no socket in between.
+    if( g_host ){
+        if( message != "" ) PostMessage( s_hostRoom, PacketView( MESSAGE_PACKET, message, s_name ) );
+        return RESULT_OK;
+    }
+
+    //Not connected to the host, nothing to do until we are.
+    if( s_link != LINK_CONNECTED ){
+        if( message != "" ) Write_Notice( "Not connected, your message wasn't sent." );
+        message.clear();
+        if( UpdateConnection() != RESULT_OK ) return RESULT_SLEEP;
+    }
+
+    //Only send when we actually have a message to send, it gets queued if the socket is full.
+    if( message != ""){
+        g_clientSocket.send( PacketView( MESSAGE_PACKET, message, s_name ) );
+        g_clientSocket.flush();
+    }
+
+    //WaitForEvents() already waited for the socket, and it's non-blocking, so just see what's there instead of asking
+    //if something is first. Nothing being there costs one recv() that says so.
+    bool received = false;
+    int result;
+    PacketView packet;
+    //Go through every packet that arrived.
+    do{
+        result = g_clientSocket.receive( packet );
+        switch( result ){
             case RESULT_DISCONNECTED:
-                End_Screen();
-                printf("The host has disconnected, thank's for using this.\n");
-                exit(0);
+                //Try to get back in, resuming where we left off.
+                Write_Notice( "Lost connection to the host, reconnecting..." );
+                Clear_Members();
+                s_resume = ( g_clientSocket.version >= WIRE_V2 );
+                s_reconnectDelay = RECONNECT_DELAY_MIN;
+                RetryLater( "Lost connection" );
+                return RESULT_DISCONNECTED;
+            //Received everything there was.
+            case RESULT_SLEEP:
                 break;
             //Error.
-            default :
-                std::cerr << "Packet reception failed : " << strerror(errno) << std::endl;
+            case RESULT_ERROR:
+                Log( "Packet reception failed : %s", strerror(errno) );
+                break;
+            case RESULT_OK :
+                HandlePacket( packet );
+                received = true;
                 break;
         }
+    } while( result == RESULT_OK );
+    //Send what's been waiting, if the socket has room for it now.
+    if( g_clientSocket.queued() ) g_clientSocket.flush();
+    return received ? RESULT_OK : RESULT_SLEEP;
+}
+
+//Encodes a room's history messages from start up to the end of the chunk start is in, or the newest message.
+//Whole chunks are cached and shared, returns the chunk and puts the sequence number after it in next.
+static Frame HistoryChunk( Room* room, int version, uint64_t start, uint64_t& next ){
+    History& history = room->history;
+    std::map< uint64_t, Frame >& chunks = room->historyChunks[version];
+
+    //The chunk start is in.
+    uint64_t chunkStart = ( ( start - 1 ) / HISTORY_CHUNK_MESSAGES ) * HISTORY_CHUNK_MESSAGES + 1;
+    uint64_t chunkEnd = chunkStart + HISTORY_CHUNK_MESSAGES;
+    next = std::min( chunkEnd, history.lastSequence() + 1 );
+    //Only whole chunks get cached, anything else is a one-off.
+    bool whole = ( start == chunkStart && next == chunkEnd );
+    if( whole ){
+        auto chunk = chunks.find( chunkStart );
+        if( chunk != chunks.end() ) return chunk->second;
     }
-    //Socket is ready to write ( aka send() ).
-    if( FD_ISSET( g_clientSocket.sockfd, &s_clientfdSets.writefds ) ){
-        //Only send when we actually have a message to send.
-        if( message != ""){
-            SendMessage(MESSAGE_PACKET, g_clientSocket, {message, s_name});
+
+    //Encoded straight out of the history's ring. Senders might not be in the room anymore, so version 3 gets every
+    //sender's name with the first of their messages in the chunk and only the number after that. Every chunk says
+    //them again, a client can start at any of them.
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    std::vector< uint32_t > named;
+    for( uint64_t sequence = start; sequence < next; sequence++ ){
+        size_t index = sequence - history.firstSequence();
+        uint32_t sender = history.senderId(index);
+        PacketView packet( MESSAGE_PACKET, history.message(index), history.sender(index), sequence, sender );
+        if( version >= WIRE_V3 ){
+            if( std::find( named.begin(), named.end(), sender ) != named.end() ) packet.sender = {};
+            else named.push_back( sender );
         }
+        Socket::encode( packet, version, *frame );
     }
-    return RESULT_OK;
+    if( whole ) chunks[chunkStart] = frame;
+    return frame;
 }
 
-int PollMessagesServer(){
-    //select() overrides, so copy the master value.
-    s_serverfdSets.readfds = s_serverfdSets.master;
-    s_serverfdSets.writefds = s_serverfdSets.master;
+//Starts sending the history of it's room to a connection. A resuming client only gets the messages after since,
+//unless some of them were already thrown out, then it gets everything we have.
+//The history isn't queued all at once, StreamHistory() sends it a chunk at a time.
+static void SendHistory( Connection* connection, bool resuming, uint64_t since ){
+    History& history = connection->room->history;
+    uint64_t start = history.firstSequence();
+    if( resuming && since + 1 >= history.firstSequence() && since <= history.lastSequence() ){
+        start = since + 1;
+    }
+    //Tell a resuming client where we start.
+    if( resuming ) QueuePacket( connection, PacketView( RESUME_PACKET, "", "", start ) );
+    //Nothing to catch up on.
+    connection->historyEnd = history.lastSequence() + 1;
+    if( start > history.lastSequence() ) return;
+    connection->historySequence = start;
+    //Still on the list from the last room it was in.
+    if( connection->catchingUp ) return;
+    connection->catchingUp = true;
+    s_worker->catchingUp.push_back( connection );
+}
 
-    //timeval of 0 seconds make select() non-blocking.
-    struct timeval timeout = {0, 50};
+//A connection got all of the history, let go of everything that was held back and get back to live traffic.
+static void FinishCatchingUp( Connection* connection ){
+    for( Frame& frame : connection->heldFrames ) QueueFrame( connection, frame );
+    connection->heldFrames.clear();
+    connection->historyEnd = connection->historySequence;
+    connection->historySequence = 0;
+    connection->catchingUp = false;
+}
 
-    int ready = select( s_serverfdSets.maxfd + 1, &s_serverfdSets.readfds, &s_serverfdSets.writefds, nullptr, &timeout);
-    //Nothing..
-    if( ready == 0 ) return RESULT_SLEEP;
-    //Error!
-    else if( ready == ERR ) return RESULT_ERROR;
+//Queues the next history chunk for a peer that's linking up, like StreamHistory() does for clients but going through
+//every room it has to get. Once it got all of them it's told that's all with a PEER_PACKET and gets what was held
+//back. Returns false then. (hold g_serverMutex.)
+static bool StreamPeerSync( Connection* connection, size_t& budget ){
+    std::vector< std::pair< Room*, uint64_t > >& rooms = connection->peerSync;
+    while( !rooms.empty() ){
+        Room* room = rooms.back().first;
+        uint64_t& sequence = rooms.back().second;
+        History& history = room->history;
+        //Skip whatever got thrown out of the history in the meantime, the room's done once it's caught up.
+        sequence = std::max( sequence, history.firstSequence() );
+        if( sequence > history.lastSequence() ){
+            rooms.pop_back();
+            continue;
+        }
+        //Out of budget, or it didn't send the last chunk yet.
+        if( !budget || connection->socket.queuedSize() >= HISTORY_LOW_WATER ) return true;
+        //Chunks of different rooms go out one after another, so every one says which room it's about.
+        uint64_t next;
+        Frame chunk = HistoryChunk( room, WIRE_V2, sequence, next );
+        QueuePacket( connection, PacketView( ROOM_PACKET, room->name, "" ) );
+        QueueFrame( connection, chunk );
+        sequence = next;
+        budget -= std::min( budget, chunk->size() );
+        return true;
+    }
+    QueuePacket( connection, PacketView( PEER_PACKET, std::to_string( WIRE_V2 ), s_name ) );
+    for( Frame& frame : connection->heldFrames ) QueueFrame( connection, frame );
+    connection->heldFrames.clear();
+    connection->catchingUp = false;
+    Log( "%s is relaying for us.", connection->name.c_str() );
+    return false;
+}
 
-        //If the serverSocket wants to read, that means a client is trying to connect to it.
-        //Accept.
-        if( FD_ISSET(g_serverSocket.sockfd, &s_serverfdSets.readfds) ){
-            //Communication socket.
-            Socket commSocket;
-            //Plug commSocket into accept().
-            g_serverSocket.accept( commSocket );
-            //Update the max file descriptor.
-            s_serverfdSets.maxfd = std::max( s_serverfdSets.maxfd, commSocket.sockfd );
-            //Move it to the vector or else it will be automatically destroyed.
-            g_commVector.push_back( std::move(commSocket) );
-            //Add it to our master set.
-            FD_SET( g_commVector.back().sockfd, &s_serverfdSets.master );
-
-            //Send to the client the member list for them to print.
-            for( std::string s : g_memberList ) SendMessage(CONNECT_PACKET, g_commVector.back(), {"", s});
-            //Send to the client all the messages for them to print.
-            for( Message m : g_messageArchive ) SendMessage( MESSAGE_PACKET, g_commVector.back(), m);
-        }
-
-    //Loop through all the active communication sockets and check if they wanna read.
-    for( auto i = g_commVector.begin() ; i != g_commVector.end(); ){
-        int packetType;
-        if( FD_ISSET(i->sockfd, &s_serverfdSets.readfds) ){
-            Message receivedMessage;
-            //Receive the message from the socket and send it to all communication sockets.
-            packetType = ReceiveMessage(*i, receivedMessage);
-            //Put the message on the message archive.
-            switch( packetType ) {
-                //Received a message.
-                case MESSAGE_PACKET:
-                    g_messageArchive.push_back( receivedMessage );
-                    //Broad cast message to all the communication sockets, which in turn will send to the clients.
-                    for( Socket& j : g_commVector ) SendMessage(packetType, j, receivedMessage );
-                    break;
+//Queues the next history chunk for the connections catching up, as long as they're done sending the last one
+//and the tick's budget isn't spent. Connections that got all of it go back to getting live traffic.
+static void StreamHistory(){
+    std::vector< Connection* >& catchingUp = s_worker->catchingUp;
+    size_t& turn = s_worker->catchingUpTurn;
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    size_t budget = HISTORY_TICK_BUDGET;
+    size_t amount = catchingUp.size();
+    if( turn >= amount ) turn = 0;
+    std::vector< Connection* > stillCatchingUp;
+    stillCatchingUp.reserve( amount );
+    for( size_t n = 0; n < amount; n++ ){
+        Connection* connection = catchingUp[ ( turn + n ) % amount ];
+        if( connection->closed ) continue;
+        if( connection->peer ){
+            if( StreamPeerSync( connection, budget ) ) stillCatchingUp.push_back( connection );
+            continue;
+        }
+        //Switched to a room it had nothing to catch up on.
+        if( !connection->historySequence ){
+            connection->catchingUp = false;
+            continue;
+        }
+        History& history = connection->room->history;
+        //Skip whatever got thrown out of the history in the meantime.
+        connection->historySequence = std::max( connection->historySequence, history.firstSequence() );
+        //Caught up.
+        if( connection->historySequence > history.lastSequence() ){
+            FinishCatchingUp( connection );
+            continue;
+        }
+        //Out of budget, or it didn't send the last chunk yet.
+        if( !budget || connection->socket.queuedSize() >= HISTORY_LOW_WATER ){
+            stillCatchingUp.push_back( connection );
+            continue;
+        }
+        uint64_t next;
+        Frame chunk = HistoryChunk( connection->room, connection->socket.version, connection->historySequence, next );
+        QueueFrame( connection, chunk );
+        connection->historySequence = next;
+        budget -= std::min( budget, chunk->size() );
+        //That was the last of it, nothing might wake us up for it later.
+        if( connection->historySequence > history.lastSequence() ) FinishCatchingUp( connection );
+        else stillCatchingUp.push_back( connection );
+    }
+    catchingUp.swap( stillCatchingUp );
+    turn++;
+}
 
-                //We received a client's name.
-                case CONNECT_PACKET:
-                    g_memberList.push_back( receivedMessage.sender );
-                    g_socktoName[ i->sockfd ] = receivedMessage.sender;
-                    //Broad cast message to all the communication sockets, which in turn will send to the clients.
-                    for( Socket& j : g_commVector ) SendMessage(packetType, j, receivedMessage );
-                    break;
+//Is anyone catching up ready for their next chunk? The rest still have a full socket and
+//the event loop tells us when it's writable again.
+static bool HistoryPending(){
+    for( Connection* connection : s_worker->catchingUp ){
+        if( !connection->closed && connection->socket.queuedSize() < HISTORY_LOW_WATER ) return true;
+    }
+    return false;
+}
 
-                //Someone disconnected.
-                case RESULT_DISCONNECTED: {
-                    std::string& disconnectedName = g_socktoName[i->sockfd];
-                    //Gets iterator from g_memberList containing the name of the disconnected socket.
-                    auto name = std::find( g_memberList.begin(), g_memberList.end(), disconnectedName);
-                    //Erase from the list.
-                    g_memberList.erase( name );
-                    FD_CLR( i->sockfd, &s_serverfdSets.master);
-                    i = g_commVector.erase(i);
-                    for( Socket& j : g_commVector ) SendMessage(DISCONNECT_PACKET, j, {"", disconnectedName} );
-                    break;
+//Takes a connection out of it's room and tells everyone left in there. (hold g_serverMutex.)
+static void LeaveRoom( Connection* connection ){
+    Room* room = connection->room;
+    if( !room ) return;
+    //Swap with the last one and pop, order doesn't matter.
+    std::vector< Connection* >& members = s_worker->roomConnections[room];
+    size_t index = connection->roomIndex;
+    std::swap( members[index], members.back() );
+    members[index]->roomIndex = index;
+    members.pop_back();
+    room->workerMembers[ s_worker->index ]--;
+    room->versionMembers[ connection->socket.version ]--;
+    connection->room = nullptr;
+    //Whatever it was catching up on or held back belongs to the old room.
+    connection->historySequence = 0;
+    connection->heldFrames.clear();
+    RemoveMember( room, connection->name );
+}
+
+//Moves a connection into a room and sends it the member list and history, like Welcome() explains.
+//(hold g_serverMutex.)
+static void JoinRoom( Connection* connection, Room* room, bool resuming, uint64_t since ){
+    LeaveRoom( connection );
+    connection->room = room;
+    std::vector< Connection* >& members = s_worker->roomConnections[room];
+    connection->roomIndex = members.size();
+    members.push_back( connection );
+    room->workerMembers[ s_worker->index ]++;
+    room->versionMembers[ connection->socket.version ]++;
+    //Tell them where they are, clients from before rooms wouldn't know what it is.
+    if( connection->socket.version > WIRE_V1 ) QueuePacket( connection, PacketView( JOIN_PACKET, room->name, "" ) );
+    //Send to the client the member list for them to print.
+    for( uint32_t member : room->members ) QueuePacket( connection, PacketView( CONNECT_PACKET, "", g_names.name( member ), 0, member ) );
+    //Send to the client the messages they don't have yet for them to print.
+    SendHistory( connection, resuming, since );
+    //Everything broadcast up to now is covered by the member list and history it just got.
+    connection->joinedSerial = s_broadcastSerial;
+    //Broad cast message to all the communication sockets in the room, which in turn will send to the clients.
+    AddMember( room, connection->name );
+}
+
+//Lets in a client that sent it's CONNECT_PACKET, or a RESUME_PACKET when it's coming back.
+static void Welcome( Connection* connection, const PacketView& packet ){
+    bool resuming = ( packet.header.packetType == RESUME_PACKET );
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    //They're somewhere else now. Before the version changes, the room counts them as speaking the old one.
+    LeaveRoom( connection );
+    //The message holds the newest wire version the client speaks and the room it wants, older clients leave it empty
+    //and clients from before rooms only send the version.
+    int version = std::min( ParseNumber( packet.message ), WIRE_VERSION );
+    if( version > WIRE_V1 ){
+        connection->socket.version = version;
+        //Tell them, this is already sent with the new version.
+        QueuePacket( connection, PacketView( VERSION_PACKET, std::to_string(version), "" ) );
+    }
+    size_t space = packet.message.find( ' ' );
+    Room* room = ( space != std::string_view::npos ) ? GetRoom( packet.message.substr( space + 1 ) ) : nullptr;
+    if( !room ) room = GetRoom( DEFAULT_ROOM );
+
+    connection->name = packet.sender;
+    connection->welcomed = true;
+    Log( "%s joined #%s (wire version %d%s).", connection->name.c_str(), room->name.c_str(), connection->socket.version, resuming ? ", resuming" : "" );
+    JoinRoom( connection, room, resuming, packet.header.sequence );
+}
+
+//Moves a client that sent a JOIN_PACKET to the room it names, or one that sent a PART_PACKET to the default one.
+static void SwitchRoom( Connection* connection, const PacketView& packet ){
+    //It has to tell us who it is first.
+    if( !connection->welcomed ) return;
+    std::string_view name = ( packet.header.packetType == PART_PACKET ) ? DEFAULT_ROOM : packet.message;
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    Room* room = GetRoom( name );
+    if( !room ){
+        Log( "%s can't join #%.*s, bad name or too many rooms.", connection->name.c_str(), (int) std::min<size_t>( name.size(), MAX_ROOM_NAME ), name.data() );
+        return;
+    }
+    if( room == connection->room ) return;
+    Log( "%s moved to #%s.", connection->name.c_str(), room->name.c_str() );
+    JoinRoom( connection, room, packet.header.sequence != 0, packet.header.sequence );
+}
+
+//Puts what a client said on it's room's history and broadcasts it to everyone in there.
+//Nobody hears it before it's in a room. It's from whoever the client said it is when it got in, not whatever
+//name it put on the packet, only the servers relaying for us get to say who a message is from.
+static void ClientMessage( Connection* connection, const PacketView& packet ){
+    if( !connection->room ) return;
+    PacketView message = packet;
+    message.sender = connection->name;
+    PostMessage( connection->room, message );
+}
+
+//Lets in a server that wants to relay for us. It gets every room's member list right away and their newest history
+//through StreamHistory(), then a PEER_PACKET to say that's all, and from then on every broadcast of every room.
+static void WelcomePeer( Connection* connection, const PacketView& packet ){
+    if( connection->welcomed ) return;
+    //The relay link needs the sequence numbers.
+    if( ParseNumber( packet.message ) < WIRE_V2 ){
+        Log( "%.*s can't relay for us, it doesn't speak wire version 2.", (int) packet.sender.size(), packet.sender.data() );
+        return;
+    }
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    connection->socket.version = WIRE_V2;
+    connection->name = packet.sender;
+    connection->welcomed = connection->peer = true;
+    s_worker->peers.push_back( connection );
+    for( auto& entry : g_rooms ){
+        Room* room = entry.second.get();
+        std::string members;
+        for( uint32_t member : room->members ){
+            if( !members.empty() ) members += '\n';
+            members += g_names.name( member );
+        }
+        //The sequence number is so it can tell if we started over.
+        QueueFrame( connection, RelayFrame( room, PacketView( SYNC_PACKET, members, "", room->history.lastSequence() ) ) );
+        //Only the newest of it, a new link shouldn't have to carry every room's whole history.
+        History& history = room->history;
+        uint64_t start = history.firstSequence();
+        if( history.size() > PEER_SYNC_MESSAGES ) start = history.lastSequence() + 1 - PEER_SYNC_MESSAGES;
+        if( start <= history.lastSequence() ) connection->peerSync.emplace_back( room, start );
+    }
+    //Everything broadcast up to now is covered by what it just got, the rest is held back until it has the history.
+    connection->joinedSerial = s_broadcastSerial;
+    connection->catchingUp = true;
+    s_worker->catchingUp.push_back( connection );
+}
+
+//What a client can send.
+static constexpr HandlerTable< PacketHandler > c_clientHandlers = {
+    { MESSAGE_PACKET, ClientMessage },
+    { CONNECT_PACKET, Welcome },
+    { RESUME_PACKET, Welcome },
+    { JOIN_PACKET, SwitchRoom },
+    { PART_PACKET, SwitchRoom },
+    { PEER_PACKET, WelcomePeer },
+};
+
+//A server relaying for us went away, so did everyone that came in through it. (hold g_serverMutex.)
+static void DropPeer( Connection* connection ){
+    std::vector< Connection* >& peers = s_worker->peers;
+    peers.erase( std::find( peers.begin(), peers.end(), connection ) );
+    //Copied, RemoveMember() might give the number back.
+    for( auto& member : connection->peerMembers ) RemoveMember( member.first, std::string( g_names.name( member.second ) ) );
+    connection->peerMembers.clear();
+    Log( "%s stopped relaying for us.", connection->name.c_str() );
+}
+
+//Finds the room a ROOM_PACKET names. It's usually the same one as the last, which doesn't need a lookup.
+//(hold g_serverMutex.)
+static Room* RelayRoom( Room* last, std::string_view name ){
+    if( last && last->name == name ) return last;
+    return GetRoom( name );
+}
+
+//What a server relaying for us says happened, in the room the ROOM_PACKET before it named.
+static void PeerRoom( Connection* connection, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    connection->relayRoom = RelayRoom( connection->relayRoom, packet.message );
+}
+
+static void PeerMessage( Connection* connection, const PacketView& packet ){
+    //PostMessage() takes the lock itself.
+    if( connection->relayRoom ) PostMessage( connection->relayRoom, packet );
+}
+
+//Someone joined down there, remember who so they can be taken out if the link goes away.
+static void PeerConnect( Connection* connection, const PacketView& packet ){
+    Room* room = connection->relayRoom;
+    if( !room ) return;
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    AddMember( room, packet.sender );
+    connection->peerMembers.emplace_back( room, g_names.find( packet.sender ) );
+}
+
+static void PeerDisconnect( Connection* connection, const PacketView& packet ){
+    Room* room = connection->relayRoom;
+    if( !room ) return;
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    std::vector< std::pair< Room*, uint32_t > >& members = connection->peerMembers;
+    auto member = std::find( members.begin(), members.end(), std::make_pair( room, g_names.find( packet.sender ) ) );
+    if( member == members.end() ) return;
+    members.erase( member );
+    RemoveMember( room, packet.sender );
+}
+
+static constexpr HandlerTable< PacketHandler > c_peerHandlers = {
+    { ROOM_PACKET, PeerRoom },
+    { MESSAGE_PACKET, PeerMessage },
+    { CONNECT_PACKET, PeerConnect },
+    { DISCONNECT_PACKET, PeerDisconnect },
+};
+
+//What the server we relay for says, it's the one that decides who's in a room and every message's number.
+//Everything it says gets broadcast here too, to our clients and the servers relaying for us.
+static void UpstreamRoom( Connection*, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    s_upstreamRoom = RelayRoom( s_upstreamRoom, packet.message );
+    if( !s_upstreamRoom ){
+        Log( "Can't make room #%.*s, too many rooms.", (int) std::min<size_t>( packet.message.size(), MAX_ROOM_NAME ), packet.message.data() );
+    }
+}
+
+//Every room's state came through, tell it who's here. It forgot them when the link went down.
+//The link's good now, so the next time it goes down we try again right away.
+static void UpstreamSynced( Connection*, const PacketView& ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    s_upstreamSynced = true;
+    s_upstreamDelay = RECONNECT_DELAY_MIN;
+    for( auto& entry : g_rooms ){
+        for( uint32_t member : entry.second->localMembers ) RelayUp( entry.second.get(), PacketView( CONNECT_PACKET, "", g_names.name( member ) ) );
+    }
+    Log( "Linked to %s:%d.", s_peerAddress.c_str(), s_peerPort );
+}
+
+//Who's in a room, the newest of it's history comes next.
+static void UpstreamSync( Connection*, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    Room* room = s_upstreamRoom;
+    if( !room ) return;
+    //It started over since we last heard from it (it was restarted), so it's numbers mean something else now.
+    //Start over too, our clients as well.
+    if( packet.header.sequence < room->history.lastSequence() ){
+        room->history.clear();
+        for( auto& chunks : room->historyChunks ) chunks.clear();
+        Broadcast( room, PacketView( RESUME_PACKET, "", "", 1 ) );
+        Log( "%s:%d started #%s over.", s_peerAddress.c_str(), s_peerPort, room->name.c_str() );
+    }
+    //New names first, someone that's still in there keeps their number.
+    std::vector< uint32_t > members;
+    size_t start = 0;
+    while( start < packet.message.size() ){
+        size_t end = packet.message.find( '\n', start );
+        if( end == std::string_view::npos ) end = packet.message.size();
+        members.push_back( g_names.intern( packet.message.substr( start, end - start ) ) );
+        start = end + 1;
+    }
+    for( uint32_t member : room->members ) g_names.release( member );
+    room->members.swap( members );
+    Broadcast( room, packet );
+}
+
+static void UpstreamConnect( Connection*, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    if( s_upstreamRoom ) MemberJoined( s_upstreamRoom, packet.sender );
+}
+
+static void UpstreamDisconnect( Connection*, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    if( s_upstreamRoom ) MemberLeft( s_upstreamRoom, packet.sender );
+}
+
+//Keeps the number it was given, skipping the ones we already have from before the link went down.
+static void UpstreamMessage( Connection*, const PacketView& packet ){
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    Room* room = s_upstreamRoom;
+    if( !room || packet.header.sequence <= room->history.lastSequence() ) return;
+    PacketView message = packet;
+    message.header.sequence = room->history.add( packet.message, packet.sender, packet.header.sequence );
+    message.header.member = room->history.senderId( room->history.size() - 1 );
+    PruneChunks( room );
+    Broadcast( room, message );
+}
+
+static constexpr HandlerTable< PacketHandler > c_upstreamHandlers = {
+    { ROOM_PACKET, UpstreamRoom },
+    { PEER_PACKET, UpstreamSynced },
+    { SYNC_PACKET, UpstreamSync },
+    { CONNECT_PACKET, UpstreamConnect },
+    { DISCONNECT_PACKET, UpstreamDisconnect },
+    { MESSAGE_PACKET, UpstreamMessage },
+};
+
+//Waits a while before linking up with the server we relay for again, every failed try doubles the wait.
+//Getting through doesn't count as working, only a link that got synced starts the wait over.
+static void RelinkLater( const char* reason ){
+    s_upstreamLink = LINK_WAITING;
+    s_upstreamTime = std::chrono::steady_clock::now() + std::chrono::milliseconds( s_upstreamDelay );
+    Log( "Link to %s:%d : %s, trying again in %ds.", s_peerAddress.c_str(), s_peerPort, reason, ( s_upstreamDelay + 999 ) / 1000 );
+    s_upstreamDelay = std::min( s_upstreamDelay * 2, RECONNECT_DELAY_MAX );
+}
+
+//The link to the server we relay for went down. (hold g_serverMutex.)
+static void LostUpstream(){
+    s_upstream = nullptr;
+    s_upstreamRoom = nullptr;
+    s_upstreamSynced = false;
+    RelinkLater( "lost it" );
+}
+
+//The link to the server we relay for went through, it's a connection of the first worker from now on.
+//Say hello, it answers with the state of every room.
+static void Linked(){
+    s_upstreamLink = LINK_CONNECTED;
+    s_upstreamSocket.version = WIRE_V2;
+    s_upstream = AddConnection( s_upstreamSocket );
+    s_upstream->upstream = s_upstream->welcomed = true;
+    QueuePacket( s_upstream, PacketView( PEER_PACKET, std::to_string( WIRE_VERSION ), s_name ) );
+}
+
+//Moves the link to the server we relay for along without waiting on it, like UpdateConnection() does for clients.
+//Only the first worker runs it.
+static void UpdateUpstream(){
+    if( !s_relaying || s_upstreamLink == LINK_CONNECTED ) return;
+    auto now = std::chrono::steady_clock::now();
+    if( s_upstreamLink == LINK_WAITING ){
+        //Not time yet.
+        if( now < s_upstreamTime ) return;
+        s_upstreamSocket = Socket( -1, CLIENT );
+        int result = s_upstreamSocket.connect( s_peerPort, s_peerAddress.c_str() );
+        if( result == RESULT_ERROR ) RelinkLater( strerror(errno) );
+        else if( result == RESULT_OK ) Linked();
+        else{
+            s_upstreamLink = LINK_CONNECTING;
+            s_upstreamTime = now + std::chrono::milliseconds( CONNECT_TIMEOUT );
+            //It's writable once it's done, a pointer to the socket means it's that.
+            s_worker->loop.add( s_upstreamSocket.sockfd, EPOLLOUT, &s_upstreamSocket );
+        }
+        return;
+    }
+    int result = s_upstreamSocket.connected();
+    if( result == RESULT_SLEEP && now < s_upstreamTime ) return;
+    s_worker->loop.remove( s_upstreamSocket.sockfd );
+    if( result == RESULT_OK ) Linked();
+    else RelinkLater( ( result == RESULT_ERROR ) ? strerror(errno) : "timed out" );
+}
+
+//Receives every packet waiting on a connection.
+static void HandleConnection( Connection* connection ){
+    //Points into the socket's receive buffer, every handler is done with it before the next receive().
+    PacketView packet;
+    //Edge-triggered means we won't be told about this data again, so keep going until it's all gone.
+    while( !connection->closed ){
+        int result = connection->socket.receive( packet );
+        switch( result ) {
+            //Nothing left for now.
+            case RESULT_SLEEP:
+                return;
+
+            //Do what it says, unless it's nothing this kind of connection should send.
+            //Linked servers talk about rooms instead of being in them, so they get handlers of their own.
+            case RESULT_OK: {
+                const HandlerTable< PacketHandler >& handlers = connection->upstream ? c_upstreamHandlers
+                                                              : connection->peer ? c_peerHandlers : c_clientHandlers;
+                PacketHandler handler = handlers[ packet.header.packetType ];
+                if( handler ) handler( connection, packet );
+                break;
+            }
+
+            //Error, the socket is no good anymore so treat it like a disconnect.
+            case RESULT_ERROR:
+                Log( "Error receiving packet : %s", strerror(errno) );
+                [[fallthrough]];
+            //Someone disconnected.
+            case RESULT_DISCONNECTED: {
+                std::lock_guard<std::mutex> lock( g_serverMutex );
+                if( connection->upstream ) LostUpstream();
+                else if( connection->peer ) DropPeer( connection );
+                else{
+                    //Nobody knew about them yet if they never got in a room.
+                    if( connection->welcomed ) Log( "%s left.", connection->name.c_str() );
+                    LeaveRoom( connection );
                 }
+                RemoveConnection( connection );
+                break;
+            }
+        }
+    }
+}
 
-                //Error.
-                case RESULT_ERROR:
-                    std::cerr << "Error sending packet : " << strerror(errno) << std::endl;
+//Gives a freshly accepted socket to the next worker in turn.
+static void HandOut( Socket& commSocket ){
+    Worker* target = g_workers[ s_nextWorker++ % g_workers.size() ].get();
+    if( target == s_worker ) AddConnection( commSocket );
+    else{
+        //It's the other worker's now.
+        SendToWorker( target, { nullptr, commSocket.sockfd } );
+        commSocket.sockfd = -1;
+    }
+}
+
+//Stops accepting on a listener for ACCEPT_RETRY_DELAY, the connections waiting on it stay in the backlog.
+static void PauseAccepting( Socket* listener, int error ){
+    if( !s_acceptFailing ) Log( "Accept failed : %s, trying again every %dms.", strerror(error), ACCEPT_RETRY_DELAY );
+    s_acceptFailing = true;
+    s_acceptPaused.push_back( listener );
+    s_acceptTime = std::chrono::steady_clock::now() + std::chrono::milliseconds( ACCEPT_RETRY_DELAY );
+}
+
+//Accepts every connection waiting on a listener and spreads them over the workers.
+//The member list and history are sent once they tell us who they are.
+static void AcceptAll( Socket* listener ){
+    //Communication socket.
+    Socket commSocket;
+    int result;
+    while( ( result = listener->accept( commSocket ) ) == RESULT_OK ){
+        s_acceptFailing = false;
+        HandOut( commSocket );
+    }
+    if( result == RESULT_ERROR ) PauseAccepting( listener, errno );
+}
+
+//Tries the listeners that couldn't accept again, once it's time to.
+static void ResumeAccepting(){
+    if( s_acceptPaused.empty() || std::chrono::steady_clock::now() < s_acceptTime ) return;
+    std::vector< Socket* > paused;
+    paused.swap( s_acceptPaused );
+    for( Socket* listener : paused ){
+        //The ring's accept ended, start another one.
+        if( s_worker->ring ) s_worker->ring->accept( listener->sockfd, (uint64_t) listener | RING_ACCEPT );
+        else AcceptAll( listener );
+    }
+}
+
+//Goes through everything the current worker's io_uring finished.
+static void HandleCompletions(){
+    IoRing& ring = *s_worker->ring;
+    io_uring_cqe* completion;
+    while( ( completion = ring.peek() ) ){
+        int result = completion->res;
+        uint32_t flags = completion->flags;
+        uint64_t data = completion->user_data;
+        ring.seen();
+        Connection* connection = (Connection*)( data & ~(uint64_t) RING_OPERATION_MASK );
+        //Multishot requests keep going as long as this is set.
+        bool more = flags & IORING_CQE_F_MORE;
+        switch( data & RING_OPERATION_MASK ){
+            //Someone connected.
+            case RING_ACCEPT: {
+                //It's the listening socket instead of a connection.
+                Socket* listener = (Socket*) connection;
+                if( result >= 0 ){
+                    s_acceptFailing = false;
+                    Socket commSocket( result );
+                    HandOut( commSocket );
+                }
+                //Asking again right away would fail the same way, and the ring would wake us up for it over and over.
+                else if( !more ){
+                    PauseAccepting( listener, -result );
                     break;
+                }
+                if( !more ) ring.accept( listener->sockfd, data );
+                break;
             }
+            //Data arrived, it's copied out of the ring's buffer so the buffer can go right back.
+            case RING_RECEIVE:
+                if( !more ) connection->ringOperations--;
+                if( flags & IORING_CQE_F_BUFFER ){
+                    unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+                    if( result > 0 && !connection->closed ) connection->socket.deliver( ring.buffer(id), result );
+                    ring.recycle( id );
+                }
+                if( connection->closed ) break;
+                g_socketStats.receiveCalls++;
+                //They hung up, or the socket broke.
+                if( result == 0 || ( result < 0 && result != -ENOBUFS ) ) connection->socket.deliver( nullptr, 0 );
+                //Ran out of buffers (or the kernel stopped for some other reason), ask again.
+                else if( !more ) RingReceive( connection );
+                HandleConnection( connection );
+                break;
+            //A send finished, queue the rest of what's waiting.
+            case RING_SEND:
+                connection->ringOperations--;
+                connection->ringSend->busy = false;
+                if( connection->closed ) break;
+                if( result >= 0 ) connection->socket.sent( result );
+                else if( result != -EAGAIN && result != -EINTR ){
+                    //Same as the other end hanging up.
+                    if( result != -EPIPE && result != -ECONNRESET ) Log( "Send failed : %s", strerror(-result) );
+                    connection->socket.deliver( nullptr, 0 );
+                    HandleConnection( connection );
+                    break;
+                }
+                RingFlush( connection );
+                break;
         }
-        //RESULT_DISCONNECTED already handles interator advancement.
-        if( packetType != RESULT_DISCONNECTED) i++;
     }
-    return RESULT_OK;
-}
\ No newline at end of file
+}
+
+//Handles everything that happened on the current worker's sockets, waiting at most timeout milliseconds for it.
+static int PollWorker( int timeout ){
+    Worker* worker = s_worker;
+    int ready = worker->loop.wait( timeout );
+    //Error!
+    if( ready == ERR ) return RESULT_ERROR;
+
+    //Only go through the sockets that actually did something.
+    for( int i = 0; i < ready; i++ ){
+        void* data = worker->loop.events[i].data.ptr;
+
+        //A server socket wants to read, that means clients are trying to connect to it.
+        //Accept.
+        if( Socket* listener = Listener( data ) ){
+            //Unless it's waiting to try again anyway.
+            if( std::find( s_acceptPaused.begin(), s_acceptPaused.end(), listener ) == s_acceptPaused.end() ) AcceptAll( listener );
+            continue;
+        }
+        //The ring finished something.
+        if( worker->ring && data == worker->ring.get() ){
+            HandleCompletions();
+            continue;
+        }
+        //Our link upstream is done connecting.
+        if( data == &s_upstreamSocket ){
+            UpdateUpstream();
+            continue;
+        }
+        //Someone put something on our inbox, it gets gone through below.
+        if( data == worker ){
+            uint64_t count;
+            read( worker->wakeupfd, &count, sizeof(count) );
+            continue;
+        }
+        Connection* connection = (Connection*) data;
+        if( !connection->closed ){
+            uint32_t events = worker->loop.events[i].events;
+            //Socket has room again, send what's been waiting.
+            if( events & EPOLLOUT ) connection->socket.flush();
+            //A communication socket has something to say (or hung up / broke, which receive() tells us about).
+            if( events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ) HandleConnection( connection );
+        }
+    }
+
+    //Queue the broadcasts made since the last tick, by us or the other workers.
+    DrainInbox();
+    //Send everything that was queued this tick.
+    FlushConnections();
+    //Then whatever history fits in what's left of the tick.
+    if( !worker->catchingUp.empty() ){
+        StreamHistory();
+        FlushConnections();
+    }
+    //Everything queued on the ring this tick goes to the kernel at once.
+    if( worker->ring ) worker->ring->submit();
+    //Nothing can point to them anymore, unless the ring still has something going on them.
+    std::vector< std::unique_ptr<Connection> >& closed = worker->closedConnections;
+    closed.erase( std::remove_if( closed.begin(), closed.end(),
+                                  []( const std::unique_ptr<Connection>& connection ){ return connection->ringOperations == 0; } ),
+                  closed.end() );
+    return ( ready == 0 ) ? RESULT_SLEEP : RESULT_OK;
+}
+
+//Runs a worker thread until StopServer().
+static void RunWorker( Worker* worker ){
+    s_worker = worker;
+    while( !s_stopping.load() ){
+        //Nothing else to do, so wait on the sockets for as long as it takes.
+        PollWorker( HistoryPending() ? 0 : -1 );
+    }
+    //Add ours to the total.
+    std::lock_guard<std::mutex> lock( g_serverMutex );
+    s_workerStats.sendCalls += g_socketStats.sendCalls;
+    s_workerStats.packetsSent += g_socketStats.packetsSent;
+    s_workerStats.bytesSent += g_socketStats.bytesSent;
+    s_workerStats.receiveCalls += g_socketStats.receiveCalls;
+    s_workerStats.packetsReceived += g_socketStats.packetsReceived;
+    s_workerStats.submitCalls += g_socketStats.submitCalls;
+}
+
+int PollMessagesServer(){
+    //Time to try linking up again, or to give up on a try.
+    UpdateUpstream();
+    //Or to accept again.
+    ResumeAccepting();
+    //Timeout of 0 makes wait() non-blocking, WaitForEvents() already did the waiting.
+    return PollWorker(0);
+}
+
+void StopServer(){
+    s_stopping.store( true );
+    for( auto& worker : g_workers ){
+        if( !worker->thread.joinable() ) continue;
+        uint64_t one = 1;
+        write( worker->wakeupfd, &one, sizeof(one) );
+        worker->thread.join();
+    }
+    g_socketStats.sendCalls += s_workerStats.sendCalls;
+    g_socketStats.packetsSent += s_workerStats.packetsSent;
+    g_socketStats.bytesSent += s_workerStats.bytesSent;
+    g_socketStats.receiveCalls += s_workerStats.receiveCalls;
+    g_socketStats.packetsReceived += s_workerStats.packetsReceived;
+    g_socketStats.submitCalls += s_workerStats.submitCalls;
+}
+
+int WaitForEvents( int timeout, int wakeupfd ){
+    //History ready to go out can't wait, nothing would wake us up for it.
+    if( g_host && HistoryPending() ) timeout = 0;
+    //Wake up in time for the next connect try, or to give up on the one that's going. Same for the link upstream.
+    bool linking = ( !g_host && s_link != LINK_CONNECTED ) || ( g_host && s_relaying && s_upstreamLink != LINK_CONNECTED );
+    if( linking ){
+        auto left = std::chrono::ceil<std::chrono::milliseconds>( ( g_host ? s_upstreamTime : s_linkTime ) - std::chrono::steady_clock::now() );
+        int reconnectTimeout = std::max<long long>( left.count(), 0 );
+        if( timeout < 0 || reconnectTimeout < timeout ) timeout = reconnectTimeout;
+    }
+    //Same for accepting again.
+    if( g_host && !s_acceptPaused.empty() ){
+        auto left = std::chrono::ceil<std::chrono::milliseconds>( s_acceptTime - std::chrono::steady_clock::now() );
+        int acceptTimeout = std::max<long long>( left.count(), 0 );
+        if( timeout < 0 || acceptTimeout < timeout ) timeout = acceptTimeout;
+    }
+
+    pollfd fds[4];
+    int fdAmount = 0;
+    //The keyboard.
+    int keyboard = -1;
+    if( !g_headless ){
+        keyboard = fdAmount;
+        fds[fdAmount++] = { STDIN_FILENO, POLLIN, 0 };
+    }
+    //Our client socket, which only has to be writable when something's waiting to be sent,
+    //or when it's connecting since that's how it says it's done.
+    if( !g_host && s_link == LINK_CONNECTED ){
+        fds[fdAmount++] = { g_clientSocket.sockfd, (short)( POLLIN | ( g_clientSocket.queued() ? POLLOUT : 0 ) ), 0 };
+    }
+    else if( !g_host && s_link == LINK_CONNECTING ) fds[fdAmount++] = { g_clientSocket.sockfd, POLLOUT, 0 };
+    //Every server socket at once, the epoll instance is readable when any of them has something.
+    if( g_host ) fds[fdAmount++] = { g_workers[0]->loop.epollfd, POLLIN, 0 };
+    //Signals and whatever else wants to wake us up.
+    if( wakeupfd >= 0 ) fds[fdAmount++] = { wakeupfd, POLLIN, 0 };
+
+    int ready = poll( fds, fdAmount, timeout );
+    if( ready == ERR ) return ( errno == EINTR ) ? RESULT_SLEEP : RESULT_ERROR;
+    //The terminal's gone, nobody's left to read what we'd print.
+    if( keyboard >= 0 && ( fds[keyboard].revents & ( POLLHUP | POLLERR | POLLNVAL ) ) ) return RESULT_DISCONNECTED;
+    return ( ready == 0 ) ? RESULT_SLEEP : RESULT_OK;
+}
@@ -1,52 +1,225 @@
 #include "sockets.h"
+#include "eventloop.h"
+#include "history.h"
+#include "mpscqueue.h"
+#include "uring.h"
 #include <unordered_map>
+#include <map>
 #include <algorithm>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
 #include <ncurses.h>
-#include <sys/select.h>
-
-struct fdSetGroup{
-    //FD_SET containing all the active sockets.
-    fd_set master;
-    //FD_SET containing all socket file descriptors ready to be read from.
-    fd_set readfds;
-    //FD_SET contaning all socket file descriptors ready to be written to.
-    fd_set writefds;
-    //Furthest file descriptor, used for select().
-    int maxfd;
+
+//A sendmsg() handed to io_uring, it has to stay put until it completes.
+struct RingSend{
+    msghdr header;
+    iovec packets[MAX_BATCHED_PACKETS];
+    //Is it with the kernel right now? A connection only ever has one going, so the bytes go out in order.
+    bool busy = false;
+};
+
+//A chat room, everything said in it only goes to the people in it. Rooms are made the first time someone
+//joins them and stay around (with their history) after everybody left. (hold g_serverMutex.)
+struct Room{
+    std::string name;
+    //Latest messages said in the room, bounded by --history-bytes / --history-messages like it's the only one.
+    History history;
+    //Numbers (in g_names) of the people in it, every one of them counts as a use of the name.
+    std::vector< uint32_t > members;
+    //Numbers of the ones that came in through this server or the servers relaying for it. A server relaying for another
+    //one tells it about them again whenever the link comes back, it forgot them when the link went down.
+    std::vector< uint32_t > localMembers;
+    //How many of it's members every worker has, broadcasts only go to the workers that have some.
+    std::vector< int > workerMembers;
+    //How many of it's members on every worker speak each wire version, broadcasts are only encoded for the versions
+    //somebody in there speaks.
+    int versionMembers[WIRE_VERSION + 1] = {};
+    //Encoded history chunks, one map per wire version keyed by the sequence number the chunk starts with.
+    //Chunks always cover HISTORY_CHUNK_MESSAGES messages starting at a multiple of it (+ 1), so everyone
+    //catching up goes through the same chunks and they're only encoded once. They're thrown out along with their
+    //oldest message, but they aren't counted against --history-bytes: with clients of every version catching up a
+    //room can take up to about four times that (a bit more with lots of short messages, every one has a header).
+    std::map< uint64_t, Frame > historyChunks[WIRE_VERSION + 1];
+};
+
+//Everything the server knows about a connected client.
+//The event loop hands back a pointer to this with every event on the socket.
+struct Connection{
+    //Communication socket.
+    Socket socket;
+    //Name the client gave us in it's CONNECT_PACKET.
+    std::string name;
+    //Position in it's worker's connections, so removing it doesn't need a search.
+    size_t index = 0;
+    //Set once the connection is removed, so events left over from the same wait() get ignored.
+    bool closed = false;
+    //Set once the client told us who it is, it doesn't get any broadcasts before that since it gets
+    //the member list and history right then.
+    bool welcomed = false;
+    //Room it's in, null until it's welcomed.
+    Room* room = nullptr;
+    //Position in it's worker's list of connections in that room.
+    size_t roomIndex = 0;
+    //Set when packets were queued this tick, so the connection gets flushed at the end of it.
+    bool dirty = false;
+    //Sequence number of the next history message to send while the client is catching up, 0 once it's caught up.
+    //Messages aren't broadcast to it while it's catching up, it gets them from the history when it gets there.
+    uint64_t historySequence = 0;
+    //Is it on it's worker's catchingUp list? It can switch rooms while it is.
+    bool catchingUp = false;
+    //Other broadcasts held back while catching up, so they don't show up before the history.
+    std::vector<Frame> heldFrames;
+    //Broadcasts up to this one were made before it was welcomed, the member list and history it got cover them.
+    uint64_t joinedSerial = 0;
+    //Messages before this one came out of the history, so live broadcasts of them still on their way get skipped.
+    uint64_t historyEnd = 0;
+    //Only with the io_uring backend: the connection's send, and how many operations the kernel still has going
+    //on it. It isn't freed before they're all done, since their completions point to it.
+    std::unique_ptr<RingSend> ringSend;
+    int ringOperations = 0;
+    //Is it a server relaying for us (peer) or our link to the server we relay for (upstream)? Neither is in a room,
+    //they send ROOM_PACKETs to say what the next packet is about.
+    bool peer = false;
+    bool upstream = false;
+    //Room the last ROOM_PACKET from a peer named.
+    Room* relayRoom = nullptr;
+    //Everyone a peer said joined a room, they're taken out if it goes away. Their room's localMembers keeps the numbers.
+    std::vector< std::pair< Room*, uint32_t > > peerMembers;
+    //Rooms a peer that's linking up still has to get the newest history of, and the sequence number of the next message
+    //to send from each. It's on it's worker's catchingUp list until it got all of them, holding back the broadcasts.
+    std::vector< std::pair< Room*, uint64_t > > peerSync;
+};
+
+//A broadcast on it's way to the workers, all of them share the same one.
+struct BroadcastItem{
+    //Room it's for.
+    const Room* room;
+    //Packet type.
+    int type;
+    //Broadcasts are numbered in the order they're made.
+    uint64_t serial;
+    //Sequence number of the message, if it's one.
+    uint64_t sequence;
+    //Encoded once for every wire version, null for a version it isn't sent to.
+    Frame frames[WIRE_VERSION + 1];
+    //Encoded along with the room's name for the servers relaying for us, only when there are some.
+    Frame relayFrame;
+};
+
+//What goes in a worker's inbox, a broadcast for all it's connections, a freshly accepted socket for it to take on
+//or a relay frame for the first worker to send up to the server we relay for.
+struct WorkItem{
+    std::shared_ptr<const BroadcastItem> broadcast;
+    int fd = -1;
+    Frame relay;
 };
 
-//Message struct.
-struct Message{
-    std::string message;
-    std::string sender;
+//One shard of the server, with it's own event loop and the connections it was given. The first one runs
+//on the main thread and owns the listening socket, the rest (--workers) get a thread each.
+struct Worker{
+    //Epoll event loop of the worker.
+    EventLoop loop;
+    //Put all the connections here just so they don't go out of scope and DIE.
+    //They're heap allocated so the pointers given to the event loop stay valid when the vector grows.
+    std::vector< std::unique_ptr<Connection> > connections;
+    //Connections removed during the current tick, freed once all the events of the tick are handled
+    //since later events from the same wait() might still point to them.
+    std::vector< std::unique_ptr<Connection> > closedConnections;
+    //The worker's connections in every room, a broadcast only goes through the ones in it's room.
+    std::unordered_map< const Room*, std::vector< Connection* > > roomConnections;
+    //Position in g_workers.
+    int index = 0;
+    //The worker's connections that are servers relaying for us, they get every broadcast of every room.
+    std::vector< Connection* > peers;
+    //Connections that had packets queued this tick, they all get flushed once the tick is over so
+    //everything queued for the same connection goes out in as few syscalls as possible.
+    std::vector< Connection* > dirtyConnections;
+    //Connections still catching up on the history, they get a chunk at a time after the live traffic is sent.
+    std::vector< Connection* > catchingUp;
+    //Where the next tick starts going through catchingUp, so everyone gets their turn.
+    size_t catchingUpTurn = 0;
+    //Broadcasts and sockets from the other workers.
+    MpscQueue< WorkItem > inbox;
+    //Written to wake the worker up when something's put on it's inbox.
+    int wakeupfd = -1;
+    //Set once someone wrote to wakeupfd, so the rest don't bother until the worker looked at it's inbox.
+    std::atomic<bool> woken{ false };
+    //Thread running it, the first worker doesn't have one.
+    std::thread thread;
+    //The worker's io_uring with --io-uring, it does all the accepting, sending and receiving and the event loop
+    //only watches it's file descriptor and wakeupfd. Null when using plain epoll.
+    std::unique_ptr<IoRing> ring;
 };
 
+//Amount of history messages encoded together into one chunk when catching up a client.
+#define HISTORY_CHUNK_MESSAGES 256
+//Next history chunk is only queued once less than this is waiting to be sent to the client.
+#define HISTORY_LOW_WATER (64 * 1024)
+//Most bytes of history queued per tick by a worker over all it's clients catching up, live traffic goes first.
+#define HISTORY_TICK_BUDGET (512 * 1024)
+//Most worker threads --workers can ask for.
+#define MAX_WORKERS 256
+//Room everyone starts in, unless they ask for another one.
+#define DEFAULT_ROOM "lobby"
+//Most rooms a server makes, and the longest name one can have.
+#define MAX_ROOMS 4096
+#define MAX_ROOM_NAME 32
+//Port the server listens on and clients connect to, unless --port says otherwise.
+#define DEFAULT_PORT 6969
+//Most of every room's newest history messages a server relaying for us gets when it links up.
+#define PEER_SYNC_MESSAGES 4096
+//Most history messages the host's UI shows when it switches rooms.
+#define HOST_HISTORY_MESSAGES 500
+
+//How long the server waits before accepting again when it couldn't (out of file descriptors, most likely).
+#define ACCEPT_RETRY_DELAY 250
+//How long a client waits before trying to connect again, doubled after every failed try.
+#define RECONNECT_DELAY_MIN 500
+#define RECONNECT_DELAY_MAX 16000
+//How long a client waits on a host that doesn't answer before giving up on that try.
+#define CONNECT_TIMEOUT 5000
+
+//Where the client's connection to the host is at.
+//Connected and talking.
+#define LINK_CONNECTED 0
+//connect() is going.
+#define LINK_CONNECTING 1
+//Waiting a while before trying again.
+#define LINK_WAITING 2
+
 //Global variables.
-//Listening server socket (only used when hosting).
-extern Socket g_serverSocket;
+//Listening server sockets, one for every --listen (only used when hosting).
+extern std::vector< Socket > g_serverSockets;
 //User's client socket.
 extern Socket g_clientSocket;
 //Is the current user a host or a client?
 extern bool g_host;
-//Map for retrieving names from socket file descriptors..
-extern std::unordered_map<int, std::string> g_sockToName;
-//Retrieves Socket from file descriptor.
-extern std::unordered_map<int, Socket*> g_fdtoSock;
-//An archive of all the messages sent on our chatroom.
-extern std::vector< Message > g_messageArchive;
-//The list of members.
-extern std::vector< std::string > g_membersList;
-//Put all the communication sockets here just so they don't go out of scope and DIE.
-//(only used by the server.)
-extern std::vector <Socket> g_commVector;
+//Are we only running the server, with no terminal and no client of our own? (--serve)
+extern bool g_headless;
+//Every room on the server by name. (only used by the server, hold g_serverMutex.)
+extern std::unordered_map< std::string, std::unique_ptr<Room> > g_rooms;
+//The server's workers, every connection belongs to one of them. (only used by the server.)
+extern std::vector< std::unique_ptr<Worker> > g_workers;
+//Guards everything the workers share: the rooms and the order of broadcasts.
+//Only joins, leaves, messages and history chunks take it, sending to the connections doesn't.
+extern std::mutex g_serverMutex;
 
+//Splits "address:port" or "[IPv6 address]:port" in two, port stays what it was if there isn't one.
+//Unix domain sockets and bare IPv6 addresses don't have one.
+void SplitEndpoint( std::string& address, int& port );
 //Initializes our user's sockets based on the command-line arguments.
 int InitializeNetwork(int argc, char* argv[]);
-//Converts message to packet and sends it.
-int SendMessage( int type, Socket& socket, Message message );
-//Receives packet and turns it into a message and returns the packet type.
-int ReceiveMessage( Socket& socket, Message& message );
 //Polls messages received to the client.
 int PollMessagesClient(std::string& message);
-int PollMessagesServer();
\ No newline at end of file
+//Handles everything that happened on the first worker's sockets.
+int PollMessagesServer();
+//Stops the worker threads and adds their socket stats to this thread's.
+void StopServer();
+//The one place the main loop sleeps. Waits until the keyboard, our client socket, the server sockets or
+//wakeupfd have something, or timeout milliseconds pass (-1 is forever). Wakes up in time for the next
+//reconnect try and doesn't wait at all while there's history ready to stream.
+//Returns RESULT_DISCONNECTED if the terminal went away.
+int WaitForEvents( int timeout, int wakeupfd = -1 );
\ No newline at end of file
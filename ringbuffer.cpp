@@ -0,0 +1,108 @@
+#include "ringbuffer.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <algorithm>
+
+RingBuffer::~RingBuffer(){
+    delete[] data;
+}
+
+RingBuffer::RingBuffer(RingBuffer&& other) noexcept {
+    data = other.data;
+    capacity = other.capacity;
+    readPos = other.readPos;
+    writePos = other.writePos;
+    other.data = nullptr;
+    other.capacity = other.readPos = other.writePos = 0;
+}
+
+RingBuffer& RingBuffer::operator=(RingBuffer&& other) noexcept {
+    if( this != &other ){
+        delete[] data;
+        data = other.data;
+        capacity = other.capacity;
+        readPos = other.readPos;
+        writePos = other.writePos;
+        other.data = nullptr;
+        other.capacity = other.readPos = other.writePos = 0;
+    }
+    return *this;
+}
+
+void RingBuffer::peek( size_t offset, void* destination, size_t len ) const {
+    size_t start = ( readPos + offset ) & ( capacity - 1 );
+    //Whatever doesn't fit before the end of the ring is at the start of it.
+    size_t first = std::min( len, capacity - start );
+    memcpy( destination, data + start, first );
+    memcpy( (char*) destination + first, data, len - first );
+}
+
+const char* RingBuffer::contiguous( size_t len ){
+    size_t start = readPos & ( capacity - 1 );
+    if( start + len > capacity ){
+        //Turn the ring so the front is at the start of the memory, in place.
+        size_t waiting = size();
+        std::rotate( data, data + start, data + capacity );
+        readPos = 0;
+        writePos = waiting;
+    }
+    return data + ( readPos & ( capacity - 1 ) );
+}
+
+void RingBuffer::consume( size_t len ){
+    readPos += len;
+    //Empty, so start from the beginning again, that way most packets won't wrap.
+    if( readPos == writePos ) readPos = writePos = 0;
+}
+
+void RingBuffer::reserve( size_t len ){
+    if( len <= capacity ) return;
+    //Grow to the next power of two that fits.
+    size_t newCapacity = ( capacity ) ? capacity : RING_BUFFER_SIZE;
+    while( newCapacity < len ) newCapacity *= 2;
+    //Copy whatever's waiting to the start of the new ring.
+    char* newData = new char[ newCapacity ];
+    size_t waiting = size();
+    if( waiting ) peek( 0, newData, waiting );
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+    readPos = 0;
+    writePos = waiting;
+}
+
+ssize_t RingBuffer::receive( int fd ){
+    //Nothing was ever received, so the ring doesn't exist yet.
+    if( !capacity ) reserve( RING_BUFFER_SIZE );
+    //Ring's full, make room.
+    if( !space() ) reserve( capacity * 2 );
+
+    //Free space is at most two pieces, from the write position to the end of the ring
+    //and from the start of the ring up to the read position.
+    size_t start = writePos & ( capacity - 1 );
+    size_t first = std::min( space(), capacity - start );
+    iovec pieces[2];
+    pieces[0].iov_base = data + start;
+    pieces[0].iov_len = first;
+    pieces[1].iov_base = data;
+    pieces[1].iov_len = space() - first;
+
+    msghdr header = {0};
+    header.msg_iov = pieces;
+    header.msg_iovlen = ( pieces[1].iov_len ) ? 2 : 1;
+    ssize_t dataReceived = recvmsg( fd, &header, 0 );
+    if( dataReceived > 0 ) writePos += dataReceived;
+    return dataReceived;
+}
+
+void RingBuffer::write( const void* source, size_t len ){
+    if( !len ) return;
+    if( space() < len ) reserve( size() + len );
+    //Same two pieces as receive().
+    size_t start = writePos & ( capacity - 1 );
+    size_t first = std::min( len, capacity - start );
+    memcpy( data + start, source, first );
+    memcpy( data, (const char*) source + first, len - first );
+    writePos += len;
+}
@@ -0,0 +1,47 @@
+//Byte ring that received data sits in until it makes whole packets.
+//Reading and writing just move two positions around, so taking a packet off the front never
+//moves the bytes behind it, and the kernel can fill all the free space with a single syscall.
+#pragma once
+#include <cstddef>
+#include <sys/types.h>
+
+//Starting size of a ring, always a power of two. It's only allocated once something is received.
+#define RING_BUFFER_SIZE 16384
+
+class RingBuffer{
+    public:
+        RingBuffer() = default;
+        //Frees the ring.
+        ~RingBuffer();
+        //Every ring owns it's memory, so only moving makes sense.
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+        RingBuffer(RingBuffer&& other) noexcept;
+        RingBuffer& operator=(RingBuffer&& other) noexcept;
+
+        //Amount of bytes waiting to be read.
+        size_t size() const { return writePos - readPos; }
+        //Amount of bytes that can still be written before the ring is full.
+        size_t space() const { return capacity - size(); }
+        //Copies len bytes starting offset bytes after the front into destination, even if they wrap around.
+        void peek( size_t offset, void* destination, size_t len ) const;
+        //Makes the first len bytes one piece if they wrap around the end of the ring, and returns where they start.
+        //They only get moved when they do wrap, which is rare since an empty ring starts over at the beginning.
+        const char* contiguous( size_t len );
+        //Throws away len bytes from the front.
+        void consume( size_t len );
+        //Makes the ring big enough to hold len bytes in total.
+        void reserve( size_t len );
+        //Receives as much as fits from fd with a single recvmsg(), returns whatever recvmsg() returned.
+        ssize_t receive( int fd );
+        //Copies len bytes onto the end, growing the ring if they don't fit. For bytes someone else received.
+        void write( const void* source, size_t len );
+
+    private:
+        //The ring itself.
+        char* data = nullptr;
+        //Size of the ring, a power of two so positions wrap with a mask.
+        size_t capacity = 0;
+        //Positions only ever go up, the index in data is the position masked with capacity - 1.
+        size_t readPos = 0, writePos = 0;
+};
@@ -0,0 +1,79 @@
+#include "scrollback.h"
+#include <algorithm>
+
+void Scrollback::add( std::string_view text, short color, size_t colorFrom, size_t colorTo ){
+    //Sizes are 32 bits.
+    if( text.size() > UINT32_MAX ) text = text.substr( 0, UINT32_MAX );
+    offsets.push_back( data.size() );
+    sizes.push_back( text.size() );
+    colors.push_back( color );
+    colorsFrom.push_back( std::min( colorFrom, text.size() ) );
+    colorsTo.push_back( std::min( colorTo, text.size() ) );
+    data.append( text );
+    layouts.push_back( 0 );
+    lineCounts.push_back( 0 );
+    breakIndexes.push_back( 0 );
+    //New entries are always on screen, might as well wrap them now.
+    wrap( size() - 1 );
+}
+
+void Scrollback::clear(){
+    data.clear();
+    offsets.clear();
+    sizes.clear();
+    colors.clear();
+    colorsFrom.clear();
+    colorsTo.clear();
+    layouts.clear();
+    lineCounts.clear();
+    breakIndexes.clear();
+    breaks.clear();
+}
+
+void Scrollback::setWidth( int newWidth ){
+    if( (size_t) std::max( newWidth, 1 ) == width ) return;
+    width = std::max( newWidth, 1 );
+    //Every layout is out of date now, they're redone when they're needed.
+    generation++;
+    breaks.clear();
+}
+
+void Scrollback::wrap( size_t index ){
+    std::string_view text = this->text( index );
+    layouts[index] = generation;
+    breakIndexes[index] = breaks.size();
+    uint32_t count = 1;
+    size_t start = 0;
+    while( true ){
+        //A line can take up to width characters, plus the space or newline it's wrapped at.
+        std::string_view next = text.substr( start, width + 1 );
+        size_t end = next.find( '\n' );
+        if( end == std::string_view::npos ){
+            //What's left fits.
+            if( text.size() - start <= width ) break;
+            //Wrap at the last space, or cut the word if there isn't one.
+            end = next.rfind( ' ' );
+            if( end == std::string_view::npos || end == 0 ) end = width - 1;
+        }
+        //The next line starts after the space or newline (or right after the cut).
+        start += end + 1;
+        breaks.push_back( start );
+        count++;
+    }
+    lineCounts[index] = count;
+}
+
+size_t Scrollback::lineStart( size_t index, size_t line ){
+    layout( index );
+    return ( line == 0 ) ? 0 : breaks[ breakIndexes[index] + line - 1 ];
+}
+
+std::string_view Scrollback::line( size_t index, size_t line ){
+    size_t start = lineStart( index, line );
+    //The last line goes to the end of the text.
+    if( line + 1 >= lineCounts[index] ) return text( index ).substr( start );
+    std::string_view text = this->text( index ).substr( start, breaks[ breakIndexes[index] + line ] - start );
+    //Leave out what it was wrapped at.
+    if( !text.empty() && ( text.back() == ' ' || text.back() == '\n' ) ) text.remove_suffix( 1 );
+    return text;
+}
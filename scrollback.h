@@ -0,0 +1,58 @@
+//Keeps everything written to the chat box, so it can be scrolled back through however much there is.
+//Every entry (a message, a connection, a notice) is kept once as the text that's shown, all of them in one string,
+//and every entry gets a slot in one array per field (where it's text is, how long it is, which part is in color).
+//Nothing is drawn here: the chat box asks for the lines of the entries it has room for and draws them whole.
+//Entries are wrapped at spaces (or newlines) into lines of at most width characters, a word longer than a line gets
+//cut. Where the lines start is worked out once per width and kept, changing the width only throws that out, so every
+//entry gets wrapped again the first time it's asked for a line and the ones nobody scrolls to never are.
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class Scrollback{
+    public:
+        //Adds an entry, text from colorFrom to colorTo is shown in color and the rest isn't.
+        void add( std::string_view text, short color, size_t colorFrom, size_t colorTo );
+        //Throws out every entry.
+        void clear();
+        //Lines are wrapped after width characters.
+        void setWidth( int width );
+        //Amount of entries.
+        size_t size() const { return offsets.size(); }
+        //Amount of lines the index-th entry is wrapped into.
+        size_t lines( size_t index ){ layout( index ); return lineCounts[index]; }
+        //Where the line'th line of the index-th entry starts in it's text.
+        size_t lineStart( size_t index, size_t line );
+        //Text of the index-th entry's line'th line, without the space or newline it was wrapped at.
+        std::string_view line( size_t index, size_t line );
+        //Text of the index-th entry, and it's color and what part of it is in it.
+        std::string_view text( size_t index ) const { return std::string_view( data.data() + offsets[index], sizes[index] ); }
+        short color( size_t index ) const { return colors[index]; }
+        size_t colorFrom( size_t index ) const { return colorsFrom[index]; }
+        size_t colorTo( size_t index ) const { return colorsTo[index]; }
+
+    private:
+        //Wraps the index-th entry, unless it already was at this width.
+        void layout( size_t index ){ if( layouts[index] != generation ) wrap( index ); }
+        void wrap( size_t index );
+
+        //Text of every entry, one after another.
+        std::string data;
+        //One array per field: where the entry's text is in data, it's size, it's color and where the color starts / ends.
+        std::vector<size_t> offsets;
+        std::vector<uint32_t> sizes;
+        std::vector<short> colors;
+        std::vector<uint32_t> colorsFrom, colorsTo;
+        //Layout of every entry: the generation it was wrapped in (it's out of date if that isn't the current one), it's
+        //amount of lines and where the starts of it's lines after the first are in breaks.
+        std::vector<uint32_t> layouts, lineCounts, breakIndexes;
+        //Starts of the lines after the first of every wrapped entry that has them, one entry after another.
+        std::vector<uint32_t> breaks;
+        //Goes up every time the width changes, 0 is never used so new slots are out of date.
+        uint32_t generation = 1;
+        //Characters per line.
+        size_t width = 1;
+};
@@ -1,52 +1,130 @@
 #include "sockets.h"
-#include "io.h"
+#include "log.h"
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <cstddef>
+#include <algorithm>
+
+thread_local SocketStats g_socketStats = {0};
+
+//Can we make IPv6 sockets at all? Kernels can be built (or booted) without it.
+static bool HasIPv6(){
+    static int has = -1;
+    if( has < 0 ){
+        int fd = socket( AF_INET6, SOCK_STREAM, 0 );
+        has = ( fd >= 0 );
+        if( fd >= 0 ) close(fd);
+    }
+    return has;
+}
+
+//Turns address and port into a socket address of whatever family the address is. "unix:" addresses are Unix domain
+//sockets, anything else goes through getaddrinfo() so IPv4, IPv6 and names all work. A server without an address
+//(or with "localhost") listens on every interface, over IPv6 when there is any since that takes IPv4 clients too.
+//Returns false with errno set if there's no such address.
+static bool MakeAddress( int socketmode, int port, const char* address, sockaddr_storage& out, socklen_t& size ){
+    out = {};
+    if( address && !strncmp( address, UNIX_PREFIX, strlen(UNIX_PREFIX) ) ){
+        const char* path = address + strlen(UNIX_PREFIX);
+        sockaddr_un* unixAddress = (sockaddr_un*) &out;
+        size_t length = strlen( path );
+        if( !length || length >= sizeof( unixAddress->sun_path ) ){
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        unixAddress->sun_family = AF_UNIX;
+        memcpy( unixAddress->sun_path, path, length );
+        //A leading @ means the abstract namespace, there's no file and the name starts with a null byte instead.
+        //It isn't null terminated, the size says where it ends.
+        if( path[0] == '@' ) unixAddress->sun_path[0] = '\0';
+        else length++;
+        size = offsetof( sockaddr_un, sun_path ) + length;
+        return true;
+    }
+
+    addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if( socketmode == SERVER && ( !address || !*address || !strcmp( address, "localhost" ) ) ){
+        hints.ai_family = HasIPv6() ? AF_INET6 : AF_INET;
+        hints.ai_flags = AI_PASSIVE;
+        address = nullptr;
+    }
+    //The port must be serialized, getaddrinfo() does it if we hand it over as a string.
+    std::string service = std::to_string( port );
+    addrinfo* found;
+    int result = getaddrinfo( address, service.c_str(), &hints, &found );
+    if( result ){
+        //It only sets errno for system errors, anything else means there's no such address.
+        if( result != EAI_SYSTEM ) errno = ENXIO;
+        return false;
+    }
+    //First one's good enough, they're sorted by how likely they are to work.
+    memcpy( &out, found->ai_addr, found->ai_addrlen );
+    size = found->ai_addrlen;
+    freeaddrinfo( found );
+    return true;
+}
+
+//Is the Unix domain socket at address left behind by a server that's gone? Nobody answers on one of those.
+//One that's still in use is left alone, binding to it fails instead of taking it over.
+static bool Abandoned( const sockaddr* address, socklen_t size ){
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd == ERR ) return false;
+    bool abandoned = ( ::connect( fd, address, size ) == ERR && errno == ECONNREFUSED );
+    close( fd );
+    return abandoned;
+}
 
 Socket::Socket(int socketmode, int socket_type, int port, const char* address){
     //Remember if the socket is a client or server.
     this->socketmode = socketmode;
-    //Creates the socket, returns a socket file descriptors. ( AF_INET = IPv4 ).
-    this->sockfd = socket(AF_INET, socket_type, 0);
+    sockaddr_storage socketAddress;
+    socklen_t addressSize;
+    if( !MakeAddress( socketmode, port, address, socketAddress, addressSize ) ){
+        Fatal( "Couldn't find address %s : %s", address ? address : "*", strerror(errno) );
+    }
+    //Creates the socket, returns a socket file descriptors. The family is whatever the address turned out to be.
+    this->sockfd = socket(socketAddress.ss_family, socket_type, 0);
     //Couldn't create socket..
-    if( sockfd == ERR ){
-        End_Screen();
-        std::cerr << "Couldn't create socket : " << strerror(errno) << std::endl;
-        exit(1);
-    }
-    //IPv4 Address+Port definition.
-    sockaddr_in socketAddress = {0};
-    socketAddress.sin_family = AF_INET;
-    //The port must be serialized.
-    socketAddress.sin_port = htons(port);
-    //inet_addr doesn't recognize "localhost" so i have to convert it to INADDR_ANY / 127.0.0.1.
-    socketAddress.sin_addr.s_addr = (!strcmp(address, "localhost")) 
-                                    ? ( socketmode == SERVER ) 
-                                        ? INADDR_ANY : inet_addr("127.0.0.1")
-                                    : inet_addr(address);
+    if( sockfd == ERR ) Fatal( "Couldn't create socket : %s", strerror(errno) );
 
     //We'll use this later for error checking.
     int bindReturn;
-    //Binds the socket to the address and port, have to convert sockaddr_in to
+    //Binds the socket to the address and port, have to convert sockaddr_storage to
     //the more generic all-purpose sockaddr.
     if( socketmode == SERVER ){
         int opt = 1;
         //Allows up to reuse the address whenever the socket is closed.
         setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        //Take IPv4 clients on an IPv6 socket too, it only matters when listening on every interface.
+        if( socketAddress.ss_family == AF_INET6 ){
+            int off = 0;
+            setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        }
+        //A Unix domain socket left behind by a server that's gone would keep us from binding, files that aren't
+        //sockets and sockets another server is still listening on are left alone.
+        sockaddr_un* unixAddress = (sockaddr_un*) &socketAddress;
+        struct stat status;
+        if( socketAddress.ss_family == AF_UNIX && unixAddress->sun_path[0] &&
+            stat( unixAddress->sun_path, &status ) == 0 && S_ISSOCK( status.st_mode ) &&
+            Abandoned( (sockaddr*)&socketAddress, addressSize ) ){
+            unlink( unixAddress->sun_path );
+        }
         //Binds the socket.
-        bindReturn = bind( sockfd, (sockaddr*)&socketAddress, 
-                                            sizeof(socketAddress));
+        bindReturn = bind( sockfd, (sockaddr*)&socketAddress, addressSize );
     }
     //Connects to the socket binded to the address and port.
     else{
-        bindReturn = connect(sockfd, (sockaddr*)&socketAddress, sizeof(socketAddress));
+        bindReturn = ::connect(sockfd, (sockaddr*)&socketAddress, addressSize);
     }
 
     //Error checking
     if( bindReturn < 0 ){
-        std::string error = (socketmode == CLIENT) ? "Failed to connect socket to address : "
+        const char* error = (socketmode == CLIENT) ? "Failed to connect socket to address : "
                                                    : "Couldn't bind socket to address : ";
-        End_Screen();
-        std::cerr << error << strerror(errno) << std::endl;
-        exit(1);
+        Fatal( "%s%s", error, strerror(errno) );
     }
 
     //If we're a server start listening.
@@ -56,148 +134,267 @@ Socket::Socket(int socketmode, int socket_type, int port, const char* address){
 //Not much to say here.
 Socket::Socket( int fd, int socketmode ) : socketmode(socketmode), sockfd(fd) {}
 
+int Socket::connect( int port, const char* address ){
+    if( socketmode != CLIENT ) return RESULT_ERROR;
+    //Whatever was left over belonged to the old connection.
+    if( sockfd >= 0 ) close(sockfd);
+    outQueue.clear();
+    outOffset = queuedBytes = 0;
+    inBuffer = RingBuffer();
+    version = WIRE_V1;
+
+    sockaddr_storage socketAddress;
+    socklen_t addressSize;
+    if( !MakeAddress( socketmode, port, address, socketAddress, addressSize ) ) return RESULT_ERROR;
+    sockfd = socket(socketAddress.ss_family, SOCK_STREAM, 0);
+    if( sockfd == ERR ) return RESULT_ERROR;
+    //Non-blocking from the start, so connect() doesn't wait for the other end.
+    if( setNonBlocking() != RESULT_OK ) return RESULT_ERROR;
+    if( ::connect( sockfd, (sockaddr*)&socketAddress, addressSize ) == ERR ){
+        //Still going, the socket becomes writable once it's done.
+        if( errno == EINPROGRESS ) return RESULT_SLEEP;
+        return RESULT_ERROR;
+    }
+    return RESULT_OK;
+}
+
+int Socket::connected(){
+    //How the connect() went, 0 while it's still going.
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if( getsockopt( sockfd, SOL_SOCKET, SO_ERROR, &error, &size ) == ERR ) return RESULT_ERROR;
+    if( error ){
+        errno = error;
+        return RESULT_ERROR;
+    }
+    //Only a socket that's done connecting has someone on the other end.
+    sockaddr_storage peer;
+    socklen_t peerSize = sizeof(peer);
+    if( getpeername( sockfd, (sockaddr*)&peer, &peerSize ) == ERR ){
+        return ( errno == ENOTCONN ) ? RESULT_SLEEP : RESULT_ERROR;
+    }
+    return RESULT_OK;
+}
+
 void Socket::listen(){
     //Use :: or else it'll think we're referring to Socket::listen.
     //Max Socket Count on the backlog cuz...better safe than sorry?
     if(socketmode == SERVER) {
         int listen = ::listen(sockfd, SOMAXCONN);
         //Error checking.
-        if( listen == ERR ) {
-            End_Screen();
-            std::cerr << "Couldn't make socket a listening socket : " << strerror(errno) << std::endl;
-            exit(1);
-        }
+        if( listen == ERR ) Fatal( "Couldn't make socket a listening socket : %s", strerror(errno) );
     }
 }
 
 int Socket::accept(Socket& commSocket){
     if( socketmode == SERVER ){
         //Get the socket file descriptor and use it to construct a Socket.
-        int commSockfd = ::accept(this->sockfd, NULL, NULL);
-        commSocket = Socket( commSockfd );
-        if( commSocket.sockfd == ERR ){
-            End_Screen();
-            std::cerr << "Couldn't make communication socket : " << strerror(errno) << std::endl;
-            exit(1);
+        int commSockfd;
+        while( ( commSockfd = ::accept(this->sockfd, NULL, NULL) ) == ERR ){
+            //Non-blocking server socket ran out of connections to accept.
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) return RESULT_SLEEP;
+            //Someone gave up before we got to them (or a signal came in), on to the next one.
+            if( errno != ECONNABORTED && errno != EPROTO && errno != EINTR ) return RESULT_ERROR;
         }
+        commSocket = Socket( commSockfd );
         return RESULT_OK;
     }
     else return RESULT_ERROR;
 }
 
-int Socket::send(Packet& packet ){
-    //Packet that we're gonna send.
-    Packet sentPacket = packet;
-    //Total data sent.
-    size_t totalDataSent = 0;
+int Socket::setNonBlocking( bool nonBlocking ){
+    //Keep whatever flags were already there.
+    int flags = fcntl( sockfd, F_GETFL, 0 );
+    if( flags == ERR ) return RESULT_ERROR;
+    flags = ( nonBlocking ) ? ( flags | O_NONBLOCK ) : ( flags & ~O_NONBLOCK );
+    if( fcntl( sockfd, F_SETFL, flags ) == ERR ) return RESULT_ERROR;
+    return RESULT_OK;
+}
+
+Frame Socket::encode( const PacketView& packet, int version ){
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    encode( packet, version, *frame );
+    return frame;
+}
+
+void Socket::encode( const PacketView& packet, int version, std::string& out ){
+    //Version 1 can't describe anything bigger, so the payload gets cut off.
+    size_t maxPayloadSize = ( version == WIRE_V1 ) ? MAX_V1_PAYLOAD_SIZE : MAX_PAYLOAD_SIZE;
+    PacketHeader header = packet.header;
+    header.messageSize = std::min<size_t>( packet.message.size(), maxPayloadSize );
+    header.nameSize = std::min<size_t>( packet.sender.size(), maxPayloadSize );
+
     //Serializes packet header.
-    sentPacket.header.messageSize = htons( sentPacket.header.messageSize );
-    sentPacket.header.nameSize = htons( sentPacket.header.nameSize );
-    //The packet header in raw byte form.
-    const char* data = (const char*) &sentPacket.header;
-    //Total size of the packet header.
-    size_t packetHeaderSize = sizeof(PacketHeader);
-    //Sends the packet header first, then send the payload.
-    //This method of sending ensures that by the end of the loop all the data is sent.
-    while( totalDataSent < packetHeaderSize ){
+    unsigned char rawHeader[MAX_HEADER_SIZE];
+    size_t headerSize;
+    switch( version ){
+        case WIRE_V1: headerSize = EncodeHeader( c_wireV1, header, rawHeader ); break;
+        case WIRE_V2: headerSize = EncodeHeader( c_wireV2, header, rawHeader ); break;
+        default:      headerSize = EncodeHeader( c_wireV3, header, rawHeader ); break;
+    }
+
+    //The whole packet in raw byte form, header first then the payload.
+    //Send the actual string data and not a pointer to the string data.
+    //Because addresses are machine dependant.
+    //Only reserve for a fresh frame, reserving exactly on every append would kill the string's growth.
+    if( out.empty() ) out.reserve( headerSize + header.messageSize + header.nameSize );
+    out.append( (const char*) rawHeader, headerSize );
+    out.append( packet.message.data(), header.messageSize );
+    out.append( packet.sender.data(), header.nameSize );
+}
+
+int Socket::send( const PacketView& packet ){
+    return send( encode( packet, version ) );
+}
+
+int Socket::send( const Frame& frame ){
+    //The other end hasn't been reading for a long while, cut it loose instead of piling up memory.
+    //Shutting it down makes the event loop report it as disconnected.
+    if( queuedBytes + frame->size() > MAX_QUEUED_BYTES ){
+        shutdown( sockfd, SHUT_RDWR );
+        return RESULT_DISCONNECTED;
+    }
+    queuedBytes += frame->size();
+    //Only the pointer is copied, every socket shares the same bytes.
+    outQueue.push_back( frame );
+    return RESULT_OK;
+}
+
+int Socket::gather( iovec* packets, int max ) const {
+    int packetCount = 0;
+    for( auto i = outQueue.begin(); i != outQueue.end() && packetCount < max; i++ ){
+        //The front packet might already be partially sent.
+        size_t offset = ( packetCount == 0 ) ? outOffset : 0;
+        packets[packetCount].iov_base = (void*)( (*i)->data() + offset );
+        packets[packetCount].iov_len = (*i)->size() - offset;
+        packetCount++;
+    }
+    return packetCount;
+}
+
+void Socket::sent( size_t bytes ){
+    queuedBytes -= bytes;
+    g_socketStats.bytesSent += bytes;
+    //Take every packet that was completely sent off the queue.
+    while( bytes > 0 ){
+        size_t left = outQueue.front()->size() - outOffset;
+        //Front packet is done, onto the next one. This drops our reference to it,
+        //the last socket to send a broadcast frame frees it.
+        if( bytes >= left ){
+            bytes -= left;
+            outQueue.pop_front();
+            outOffset = 0;
+            g_socketStats.packetsSent++;
+        }
+        //Only part of it went out.
+        else{
+            outOffset += bytes;
+            bytes = 0;
+        }
+    }
+}
+
+int Socket::flush(){
+    //This method of sending ensures that by the end of the loop all the data is sent,
+    //or the socket is full and the rest waits for the next time it's writable.
+    while( !outQueue.empty() ){
+        //Gather as many queued packets as we can so they all go out in one syscall.
+        iovec packets[MAX_BATCHED_PACKETS];
+        int packetCount = gather( packets, MAX_BATCHED_PACKETS );
+        //sendmsg() instead of writev() because it takes MSG_NOSIGNAL,
+        //so a closed socket gives us an error instead of killing us with SIGPIPE.
+        msghdr header = {0};
+        header.msg_iov = packets;
+        header.msg_iovlen = packetCount;
         //Send the data and also get how much data was actual sent( in bytes ).
-        ssize_t dataSent = ::send( sockfd, data + totalDataSent, 
-                                  packetHeaderSize - totalDataSent, 0);
-        //The socket we were sending to disconnected.
-        if( dataSent == 0 ) return RESULT_DISCONNECTED;
-        else if( dataSent == ERR ) return RESULT_ERROR;
-        //Increase the total data sent.
-        totalDataSent += dataSent;
-    }
-    totalDataSent = 0;
-    //Now send the payload, starting with the message.
-    while( totalDataSent < sentPacket.message.size() ){
-        //Send the actual string data and not a pointer to the string data.
-        //Because addresses are machine dependant.
-        ssize_t dataSent = ::send( sockfd, sentPacket.message.data() + totalDataSent,
-                                 sentPacket.message.size() - totalDataSent, 0);
-        //Disconnected.
-        if( dataSent == 0 ) return RESULT_DISCONNECTED;
-        //Error!
-        else if( dataSent == ERR ) return RESULT_ERROR;
-        //Increase total data sent.
-        totalDataSent += dataSent;
-    }
-    totalDataSent = 0;
-    //And now we send the sender's name.
-    while( totalDataSent < sentPacket.sender.size() ){
-        //Send the string data.
-        ssize_t dataSent = ::send( sockfd, sentPacket.sender.data() + totalDataSent,
-                                   sentPacket.sender.size() - totalDataSent, 0);
-        //Just doing the same thing.
-        if( dataSent == 0 ) return RESULT_DISCONNECTED;
-        else if( dataSent == ERR ) return RESULT_ERROR;
-        totalDataSent += dataSent;
+        ssize_t dataSent = sendmsg( sockfd, &header, MSG_NOSIGNAL );
+        g_socketStats.sendCalls++;
+        if( dataSent == ERR ){
+            //Socket's full, we'll be told when it's writable again.
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) return RESULT_OK;
+            else if( errno == EINTR ) continue;
+            //The socket we were sending to disconnected.
+            else if( errno == EPIPE || errno == ECONNRESET ) return RESULT_DISCONNECTED;
+            return RESULT_ERROR;
+        }
+        sent( dataSent );
     }
     //All done!
     return RESULT_OK;
 }
 
-int Socket::receive( Packet& outPacket ){
-    //The resulting packet that will be received.
-    Packet resultingPacket = {0};
-    //Size of PacketHeader, good for knowing when and if we finished receiving all the header data.
-    size_t packetHeaderSize = sizeof(PacketHeader);
-    //The resulting packet header in raw byte form.
-    char* data = (char*)&resultingPacket.header;
-    //Total amount of data received by the socket in bytes.
-    size_t totalDataReceived = 0;
-    //Receive the whole header even if but a small amount was received at a time.
-    while( totalDataReceived < packetHeaderSize ){
-        ssize_t dataReceived = recv(sockfd, data + totalDataReceived,
-                                    packetHeaderSize - totalDataReceived, 0);
+void Socket::deliver( const void* data, size_t size ){
+    if( !size ) hungUp = true;
+    else inBuffer.write( data, size );
+}
+
+int Socket::decode( PacketView& outPacket ){
+    //Whoever got the last packet is done with it now.
+    if( viewed ){
+        inBuffer.consume( viewed );
+        viewed = 0;
+    }
+    if( !inBuffer.size() ) return RESULT_SLEEP;
+
+    //Headers are small, so just copy what could be one out of the ring.
+    unsigned char rawHeader[MAX_HEADER_SIZE];
+    size_t rawSize = std::min<size_t>( inBuffer.size(), MAX_HEADER_SIZE );
+    inBuffer.peek( 0, rawHeader, rawSize );
+
+    //The first byte tells the version.
+    PacketHeader header = {0};
+    int headerSize;
+    switch( rawHeader[0] ){
+        case WIRE_V2_MAGIC: headerSize = DecodeHeader( c_wireV2, rawHeader, rawSize, header ); break;
+        case WIRE_V3_MAGIC: headerSize = DecodeHeader( c_wireV3, rawHeader, rawSize, header ); break;
+        default:            headerSize = DecodeHeader( c_wireV1, rawHeader, rawSize, header ); break;
+    }
+    //Not all here yet.
+    if( headerSize == 0 ) return RESULT_SLEEP;
+    //Garbage.
+    else if( headerSize == ERR || header.messageSize > MAX_PAYLOAD_SIZE || header.nameSize > MAX_PAYLOAD_SIZE ){
+        return RESULT_ERROR;
+    }
+
+    //Payload isn't all here yet, make sure there'll be room for all of it.
+    size_t packetSize = headerSize + header.messageSize + header.nameSize;
+    if( inBuffer.size() < packetSize ){
+        inBuffer.reserve( packetSize );
+        return RESULT_SLEEP;
+    }
+
+    //Point the packet at the message and the name right where they are, they stay in the buffer until the next call.
+    const char* payload = inBuffer.contiguous( packetSize ) + headerSize;
+    outPacket.header = header;
+    outPacket.message = std::string_view( payload, header.messageSize );
+    outPacket.sender = std::string_view( payload + header.messageSize, header.nameSize );
+    viewed = packetSize;
+    g_socketStats.packetsReceived++;
+    return RESULT_OK;
+}
+
+int Socket::receive( PacketView& outPacket ){
+    //Receive until there's a whole packet in the buffer, even if but a small amount is received at a time.
+    int decoded;
+    while( ( decoded = decode( outPacket ) ) != RESULT_OK ){
+        //Whatever's on the other end isn't speaking our language.
+        if( decoded == RESULT_ERROR ) return RESULT_ERROR;
+        //Nothing gets received here, whatever was delivered is all there is for now.
+        if( external ) return hungUp ? RESULT_DISCONNECTED : RESULT_SLEEP;
+        ssize_t dataReceived = inBuffer.receive( sockfd );
+        g_socketStats.receiveCalls++;
         //They left us to rot...
         if( dataReceived == 0 ) return RESULT_DISCONNECTED;
-        //error error chicken error.
-        else if( dataReceived == ERR ) return RESULT_ERROR;
-        totalDataReceived += dataReceived;
-    }
-    //De-serialize the packet header.
-    resultingPacket.header.messageSize = ntohs( resultingPacket.header.messageSize );
-    resultingPacket.header.nameSize = ntohs( resultingPacket.header.nameSize );
-
-    totalDataReceived = 0;
-    //This'll hold the raw message, + 1 to account for the null terminator.
-    char* message = new char[ resultingPacket.header.messageSize + 1 ];
-    while( totalDataReceived < resultingPacket.header.messageSize ){
-        //Receive the data and get how much data was actually received.
-        ssize_t dataReceived = recv( sockfd, message + totalDataReceived,
-                                     resultingPacket.header.messageSize - totalDataReceived, 0);
-        //Check for cases.
-        if( dataReceived == 0 ) return RESULT_DISCONNECTED;
-        else if( dataReceived == ERR ) return RESULT_ERROR;
-        totalDataReceived += dataReceived;
-    }
-    //Null terminate.
-    message[resultingPacket.header.messageSize] = '\0';
-
-    totalDataReceived = 0;
-    //This'll hold the raw name data + 1 to account for the null terminator.
-    char* name = new char[ resultingPacket.header.nameSize + 1] ;
-    while( totalDataReceived < resultingPacket.header.nameSize ){
-        //This is getting kinda repetitive...
-        ssize_t dataReceived = recv( sockfd, name + totalDataReceived,
-                                     resultingPacket.header.nameSize - totalDataReceived, 0);
-        if( dataReceived == 0 ) return RESULT_DISCONNECTED;
-        else if( dataReceived == ERR ) return RESULT_ERROR;
-        totalDataReceived += dataReceived;
-    }
-    //Null terminate.
-    name[resultingPacket.header.nameSize] = '\0';
-
-    //Turn the message and the name c strings to std::strings and put them on the packet.
-    resultingPacket.message = std::string(message );
-    resultingPacket.sender = std::string( name );
-    //Store the processed packet to outPacket.
-    outPacket = resultingPacket;
-    //Free the memory used by the c strings.
-    delete[] message;
-    delete[] name;
+        else if( dataReceived == ERR ){
+            //Nothing more for now, the rest of the packet comes later.
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) return RESULT_SLEEP;
+            else if( errno == EINTR ) continue;
+            //Hung up on us without saying goodbye.
+            else if( errno == ECONNRESET ) return RESULT_DISCONNECTED;
+            //error error chicken error.
+            return RESULT_ERROR;
+        }
+    }
     //Done!
     return RESULT_OK;
 }
@@ -1,25 +1,68 @@
 //Handles the sockets.
-//Sockets are also blocking but that shouldn't be too much of an issues for what i'm trying to do here.
+//Communication sockets are non-blocking, anything that can't be sent right away waits on the socket's
+//outbound queue until the socket is writable again, so one slow client never holds up everyone else.
 #pragma once
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <memory>
+#include "ringbuffer.h"
+#include "wire.h"
 
 //Macros.
 
+//What failed system calls return, same value as ncurses' ERR so it doesn't matter which one got included.
+#ifndef ERR
+#define ERR (-1)
+#endif
+
 #define CLIENT 0
 #define SERVER 1
 
+//Addresses starting with it are Unix domain sockets, "unix:/path/to/socket" or "unix:@name" for one in the abstract
+//namespace (no file, it goes away with the last socket using it). Anything else is an IPv4 / IPv6 address or a name.
+#define UNIX_PREFIX "unix:"
+
 //Packet type when a user first joins, sender contains their name.
 #define CONNECT_PACKET 2
 //Packet type when a message is sent, message contains the message and sender contains the sender.
 #define MESSAGE_PACKET 3
 //Packet type when a user disconnects, sender contains their name.
 #define DISCONNECT_PACKET 4
+//Packet type the server sends to tell a client which wire version it'll use from now on, message contains it.
+//(5 to 8 aren't used, they're the same numbers as the RESULT_ values.)
+#define VERSION_PACKET 9
+//Packet type a client sends instead of CONNECT_PACKET when it comes back after losing the connection,
+//the header's sequence is the last message it got and sender is it's name. The server answers with one
+//too, where the sequence is the first message it's going to send again.
+#define RESUME_PACKET 10
+//Packet type a client sends to move to another room, message contains the room's name and the header's sequence
+//is the last message it got from that room (0 for everything). The server sends one back with the room's name once
+//it's in, right before that room's member list and history.
+#define JOIN_PACKET 11
+//Packet type a client sends to leave it's room and go back to the default one.
+#define PART_PACKET 12
+//Packet types of the relay link between two servers, the one below connects to the one above (--peer) like a client.
+//Packet type the server below says hello with, message contains it's wire version (at least 2). The server above
+//answers with one once it sent the state of every room.
+#define PEER_PACKET 13
+//Packet type that says which room the relay packet right after it is about, message contains the room's name.
+#define ROOM_PACKET 14
+//Packet type the server above sends for every room when the link comes up, message contains the room's members
+//separated by newlines, and the header's sequence is the room's newest message. The newest messages of the room's
+//history come right after it.
+#define SYNC_PACKET 15
+//Highest packet type there is, handler tables have a slot for every type up to it.
+#define MAX_PACKET_TYPE 15
 
 //Return values for the socket functions.
 #define RESULT_OK 5
@@ -27,33 +70,64 @@
 #define RESULT_ERROR 7
 #define RESULT_SLEEP 8
 
+//Most bytes a socket can have waiting on it's outbound queue before we give up on the other end.
+#define MAX_QUEUED_BYTES (16 * 1024 * 1024)
+//Most queued packets handed to the kernel with a single sendmsg() call.
+#define MAX_BATCHED_PACKETS 64
 
-//Header of the packet.
-struct PacketHeader{
-    //What kind of packet is it?
-    uint8_t packetType;
-    //Size of the message data in the payload.
-    uint16_t messageSize;
-    //Size of the name in the payload.
-    uint16_t nameSize;
-};
 
-//The data send / received by the sockets.
-struct Packet{
+//The data send / received by the sockets. It doesn't own the payload: a received packet's message and sender point
+//right into the socket's receive buffer and are only good until the next receive(), so whatever has to live longer
+//(like a message going on the history) gets copied out.
+struct PacketView{
     //Packet header.
-    PacketHeader header;
+    PacketHeader header = {0};
     //Payload.
 
     //Message data.
-    std::string message;
+    std::string_view message;
     //Name of the sender.
-    std::string sender;
+    std::string_view sender;
+
+    PacketView() = default;
+    //For packets we're about to send, the sizes in the header come from the payload.
+    PacketView( int type, std::string_view message, std::string_view sender, uint64_t sequence = 0, uint32_t member = 0 )
+        : message(message), sender(sender) {
+        header.packetType = type;
+        header.sequence = sequence;
+        header.member = member;
+        header.messageSize = message.size();
+        header.nameSize = sender.size();
+    }
 };
 
+//A serialized packet, ready to be sent. It's immutable so the same one can be queued on every socket
+//it's broadcast to, and it's freed once the last of them is done sending it.
+typedef std::shared_ptr<const std::string> Frame;
+
+//Counters for how well sends / receives are batched, packetsSent / sendCalls and
+//packetsReceived / receiveCalls are the amount of packets per syscall.
+//Every thread counts on it's own, so server workers don't fight over them.
+struct SocketStats{
+    //Amount of sendmsg() calls made (or handed to io_uring).
+    unsigned long long sendCalls;
+    //Amount of packets that were completely sent.
+    unsigned long long packetsSent;
+    //Amount of bytes sent.
+    unsigned long long bytesSent;
+    //Amount of recvmsg() calls made (or receives io_uring completed).
+    unsigned long long receiveCalls;
+    //Amount of packets decoded from received data.
+    unsigned long long packetsReceived;
+    //Amount of io_uring_enter() calls that submitted sends and receives, with the io_uring backend.
+    unsigned long long submitCalls;
+};
+extern thread_local SocketStats g_socketStats;
+
 class Socket{
     public:
-        //Creates a socket.
-        Socket(int socketmode, int socket_type, int port, const char* address = "localhost");
+        //Creates a socket, see UNIX_PREFIX for the kinds of address. Servers listen on every interface without one.
+        Socket(int socketmode, int socket_type, int port, const char* address = nullptr);
         //Default constructor.
         Socket() = default;
         //Creates a socket from a file descriptor.
@@ -70,8 +144,17 @@ class Socket{
         Socket(Socket&& other) noexcept {
             sockfd = other.sockfd;
             socketmode = other.socketmode;
+            outQueue = std::move(other.outQueue);
+            outOffset = other.outOffset;
+            queuedBytes = other.queuedBytes;
+            inBuffer = std::move(other.inBuffer);
+            viewed = other.viewed;
+            version = other.version;
+            external = other.external;
+            hungUp = other.hungUp;
             other.sockfd = -1;
             other.socketmode = -1;
+            other.outOffset = other.queuedBytes = other.viewed = 0;
         }
         //Move assignement operator.
         Socket& operator=(Socket&& other) noexcept {
@@ -79,23 +162,90 @@ class Socket{
                 if (sockfd >= 0) close(sockfd);
                 sockfd = other.sockfd;
                 socketmode = other.socketmode;
+                outQueue = std::move(other.outQueue);
+                outOffset = other.outOffset;
+                queuedBytes = other.queuedBytes;
+                inBuffer = std::move(other.inBuffer);
+                viewed = other.viewed;
+                version = other.version;
+                external = other.external;
+                hungUp = other.hungUp;
                 other.sockfd = -1;
                 other.socketmode = -1;
+                other.outOffset = other.queuedBytes = other.viewed = 0;
             }
             return *this;
         }
 
+        //Starts connecting a client socket with a new non-blocking file descriptor, throwing out anything that
+        //was queued. Returns RESULT_OK if it connected right away, RESULT_SLEEP if it's still connecting (the
+        //socket becomes writable once it's done, connected() tells how it went) and RESULT_ERROR if it can't.
+        //Unlike the constructor it doesn't block (other than looking up a name) or exit when it can't connect.
+        int connect( int port, const char* address );
+        //Did connect() go through? RESULT_SLEEP while it's still going, RESULT_ERROR with errno set if it failed.
+        int connected();
         //Start listening to clients (only servers can do this).
         void listen();
         //Accept connection of a socket and puts it on commSocket.
+        //Returns RESULT_SLEEP when a non-blocking socket has no connections left to accept, and RESULT_ERROR with
+        //errno set when it can't take the next one right now (out of file descriptors or memory), it stays waiting.
         int accept(Socket& commSocket);
-        //Send packet to socket, returns RESULT_DISCONNECTED if the other socket disconnected.
-        int send( Packet& packet );
+        //Makes the socket non-blocking, or blocking again.
+        int setNonBlocking( bool nonBlocking = true );
+        //Serializes packet into a frame with the given wire version, the frame can be queued on any amount of sockets.
+        static Frame encode( const PacketView& packet, int version );
+        //Serializes packet with the given wire version onto the end of out, for sending many packets as one frame.
+        static void encode( const PacketView& packet, int version, std::string& out );
+        //Puts packet on the outbound queue, nothing is actually sent until flush() is called.
+        //Returns RESULT_DISCONNECTED if the other socket stopped reading altogether.
+        int send( const PacketView& packet );
+        //Same thing but with an already encoded frame, which is shared and not copied.
+        int send( const Frame& frame );
+        //Sends as much of the outbound queue as the socket will take, batching queued packets into
+        //as few sendmsg() calls as possible. Call it after queueing and whenever the socket is writable.
+        int flush();
+        //Points packets at as much of the outbound queue as fits in max of them, without sending anything.
+        //Returns how many it used. They stay good until sent() takes the bytes off the queue.
+        int gather( iovec* packets, int max ) const;
+        //Takes bytes that were sent off the front of the outbound queue.
+        void sent( size_t bytes );
+        //Hands the socket bytes something else received for it, size 0 means the other end hung up.
+        //Only for external sockets.
+        void deliver( const void* data, size_t size );
+        //Is there anything left on the outbound queue?
+        bool queued() const { return !outQueue.empty(); }
+        //Amount of bytes left on the outbound queue.
+        size_t queuedSize() const { return queuedBytes; }
         //Receives packet from another socket, return RESULT_DISONNECTED if...go figure.
-        int receive( Packet& outPacket );
+        //Non-blocking sockets return RESULT_SLEEP when there's no whole packet to receive yet.
+        //Only calls recvmsg() when the receive buffer doesn't already hold a whole packet, and then takes
+        //as much as the kernel has, so most calls just decode the next packet from the buffer.
+        //Nothing is copied, outPacket points into the receive buffer until the next call.
+        int receive( PacketView& outPacket );
+        //Set when something else does the socket's receiving and hands it the bytes with deliver(), like the
+        //io_uring backend. receive() then only decodes what it was given and never calls recvmsg() itself.
+        bool external = false;
         //Socket file descriptor.
         int sockfd = -1;
+        //Wire version used for everything this socket sends (receiving handles every version).
+        int version = WIRE_V1;
     private:
+        //Views the whole packet at the front of inBuffer, returns RESULT_SLEEP if there isn't one yet
+        //and RESULT_ERROR if what's there isn't a packet.
+        int decode( PacketView& outPacket );
+
         //Is the socket a Client or a Server?
         int socketmode = SERVER;
+        //Serialized packets waiting to be sent, the one in front might be partially sent.
+        std::deque<Frame> outQueue;
+        //How much of the front packet was already sent.
+        size_t outOffset = 0;
+        //Amount of bytes still waiting on outQueue.
+        size_t queuedBytes = 0;
+        //Received bytes that weren't decoded yet, the last packet in it might not be whole yet.
+        RingBuffer inBuffer;
+        //Size of the packet at the front of inBuffer the last receive() handed out, the next one takes it off.
+        size_t viewed = 0;
+        //An external socket was told the other end hung up, receive() says so once the buffer's empty.
+        bool hungUp = false;
 };
\ No newline at end of file
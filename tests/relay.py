@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# Starts a root server and two servers relaying for it (--serve --peer), one under the other, fills a few rooms with
+# more history than one link can queue at once, then connects a client to every server and checks they all see the
+# same members and the same sequence numbers, and that the links came up once and stayed up.
+# Usage: python3 tests/relay.py [path to tchat] [first port]
+import os, socket, subprocess, sys, tempfile, time
+
+TCHAT = os.path.abspath( sys.argv[1] if len( sys.argv ) > 1 else "./tchat" )
+PORT = int( sys.argv[2] ) if len( sys.argv ) > 2 else 7400
+# 6 rooms of 4096 messages of 1 KB is more than MAX_QUEUED_BYTES (16 MB), a leaf that got it all at once would flap.
+ROOMS = 6
+MESSAGES = 4096
+SIZE = 1000
+
+CONNECT_PACKET, MESSAGE_PACKET, DISCONNECT_PACKET, JOIN_PACKET = 2, 3, 4, 11
+
+def varint( n ):
+    out = b""
+    while n >= 0x80:
+        out += bytes( [ ( n & 0x7f ) | 0x80 ] )
+        n >>= 7
+    return out + bytes( [n] )
+
+# Wire version 2 frame: magic, type, flags, then sequence number, message size and sender size as varints.
+def frame( type, message = b"", sender = b"", sequence = 0 ):
+    return bytes( [ 0xC2, type, 0 ] ) + varint( sequence ) + varint( len( message ) ) + varint( len( sender ) ) + message + sender
+
+class Client:
+    def __init__( self, port, name, room = b"lobby" ):
+        self.name = name
+        self.socket = socket.create_connection( ( "127.0.0.1", port ) )
+        self.buffer = b""
+        self.members = set()
+        self.messages = []
+        # Asks for version 2 and the room.
+        self.socket.sendall( frame( CONNECT_PACKET, b"2 " + room, name ) )
+
+    def send( self, message ):
+        self.socket.sendall( frame( MESSAGE_PACKET, message, self.name ) )
+
+    # Reads whatever arrives within timeout seconds and keeps track of members and messages.
+    def read( self, timeout = 0.5 ):
+        self.socket.settimeout( timeout )
+        try:
+            while True:
+                data = self.socket.recv( 1 << 20 )
+                if not data: break
+                self.buffer += data
+        except socket.timeout:
+            pass
+        while self.buffer:
+            packet = self.parse()
+            if not packet: break
+            type, message, sender, sequence = packet
+            if type == JOIN_PACKET: self.members.clear()
+            elif type == CONNECT_PACKET: self.members.add( sender )
+            elif type == DISCONNECT_PACKET: self.members.discard( sender )
+            elif type == MESSAGE_PACKET: self.messages.append( ( sequence, sender, message ) )
+
+    # Takes one v2 frame off the buffer, None if it isn't all there yet. The server only sends v2 after VERSION_PACKET.
+    def parse( self ):
+        buffer = self.buffer
+        if buffer[0] != 0xC2:
+            if len( buffer ) < 6: return None
+            size, name = int.from_bytes( buffer[2:4], "big" ), int.from_bytes( buffer[4:6], "big" )
+            if len( buffer ) < 6 + size + name: return None
+            self.buffer = buffer[ 6 + size + name: ]
+            return ( buffer[0], buffer[6:6+size], buffer[6+size:6+size+name], 0 )
+        values, at = [], 3
+        for _ in range( 3 ):
+            value, shift = 0, 0
+            while True:
+                if at >= len( buffer ): return None
+                byte = buffer[at]
+                at += 1
+                value |= ( byte & 0x7f ) << shift
+                shift += 7
+                if not byte & 0x80: break
+            values.append( value )
+        sequence, size, name = values
+        if len( buffer ) < at + size + name: return None
+        self.buffer = buffer[ at + size + name: ]
+        return ( buffer[1], buffer[at:at+size], buffer[at+size:at+size+name], sequence )
+
+failures = 0
+def check( what, ok ):
+    global failures
+    print( ( "ok   " if ok else "FAIL " ) + what )
+    if not ok: failures += 1
+
+logs = tempfile.mkdtemp( prefix = "tchat-relay-" )
+servers = []
+def serve( port, peer = None ):
+    command = [ TCHAT, "--serve", "--port", str( port ), "--log", os.path.join( logs, "%d.log" % port ) ]
+    if peer: command += [ "--peer", "127.0.0.1:%d" % peer ]
+    servers.append( subprocess.Popen( command ) )
+    time.sleep( 0.3 )
+
+def log( port ):
+    with open( os.path.join( logs, "%d.log" % port ) ) as file: return file.read()
+
+root, leaf, leafLeaf = PORT, PORT + 1, PORT + 2
+try:
+    serve( root )
+    # Fill the rooms on the root before anyone links up.
+    for room in range( ROOMS ):
+        filler = Client( root, b"filler", b"room%d" % room )
+        for n in range( MESSAGES ):
+            filler.send( b"%04d " % n + b"x" * ( SIZE - 5 ) )
+        # Done once our own last message came back.
+        deadline = time.time() + 30
+        while time.time() < deadline and ( not filler.messages or filler.messages[-1][0] < MESSAGES ):
+            filler.read( 0.2 )
+        check( "room%d has %d messages on the root" % ( room, MESSAGES ), filler.messages and filler.messages[-1][0] == MESSAGES )
+        filler.socket.close()
+
+    serve( leaf, root )
+    serve( leafLeaf, leaf )
+    time.sleep( 5 )
+    for port in ( leaf, leafLeaf ):
+        text = log( port )
+        check( "%d linked up once" % port, text.count( "Linked to" ) == 1 )
+        check( "%d never lost the link" % port, "trying again" not in text )
+
+    # A client on every server, in the same room.
+    clients = [ Client( root, b"alice" ), Client( leaf, b"bob" ), Client( leafLeaf, b"carol" ) ]
+    time.sleep( 1 )
+    for client in clients: client.read()
+    for client in clients:
+        check( "%s sees everyone" % client.name.decode(), client.members == { b"alice", b"bob", b"carol" } )
+
+    for client in clients:
+        client.send( b"hello from " + client.name )
+        time.sleep( 0.3 )
+    time.sleep( 0.5 )
+    for client in clients: client.read()
+    said = [ [ message for message in client.messages if message[2].startswith( b"hello from" ) ] for client in clients ]
+    check( "every message made it everywhere", all( len( messages ) == 3 for messages in said ) )
+    check( "sequence numbers match", said[0] == said[1] == said[2] )
+
+    # The synced history has the root's numbers, down to the leaf of the leaf.
+    late = Client( leafLeaf, b"dave", b"room%d" % ( ROOMS - 1 ) )
+    deadline = time.time() + 10
+    while time.time() < deadline and ( not late.messages or late.messages[-1][0] < MESSAGES ):
+        late.read( 0.2 )
+    check( "history on %d ends at %d" % ( leafLeaf, MESSAGES ), late.messages and late.messages[-1][0] == MESSAGES )
+    check( "history numbers match the text", all( text.startswith( b"%04d " % ( sequence - 1 ) ) for sequence, _, text in late.messages ) )
+
+    # Someone leaving a leaf leaves everywhere.
+    clients[2].socket.close()
+    time.sleep( 1 )
+    for client in clients[:2]:
+        client.read()
+        check( "%s saw carol leave" % client.name.decode(), client.members == { b"alice", b"bob" } )
+finally:
+    for server in servers: server.terminate()
+    for server in servers: server.wait()
+
+print( "%d failed, logs are in %s" % ( failures, logs ) if failures else "all passed" )
+sys.exit( 1 if failures else 0 )
@@ -0,0 +1,185 @@
+#include "uring.h"
+#include "sockets.h"
+#include "log.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+
+//The raw syscalls, glibc doesn't wrap them.
+static int Enter( int fd, unsigned toSubmit, unsigned minComplete, unsigned flags ){
+    return syscall( __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0 );
+}
+
+IoRing::~IoRing(){
+    if( fd >= 0 ) close(fd);
+    if( rings ) munmap( rings, ringsSize );
+    if( sqes ) munmap( sqes, sqesSize );
+    if( bufferRing ) munmap( bufferRing, IO_RING_BUFFERS * sizeof(io_uring_buf) );
+    delete[] buffers;
+}
+
+bool IoRing::setup(){
+    io_uring_params params = {0};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = IO_RING_ENTRIES * 4;
+    fd = syscall( __NR_io_uring_setup, IO_RING_ENTRIES, &params );
+    if( fd == ERR ) return false;
+    //Every kernel with multishot receives has these, anything older isn't worth the trouble.
+    if( !( params.features & IORING_FEAT_SINGLE_MMAP ) || !( params.features & IORING_FEAT_NODROP ) ){
+        errno = ENOSYS;
+        return false;
+    }
+
+    //Both queues' rings are in one mapping, the entries themselves in another.
+    ringsSize = std::max( params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe) );
+    rings = mmap( nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if( rings == MAP_FAILED ){
+        rings = nullptr;
+        return false;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*) mmap( nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if( sqes == MAP_FAILED ){
+        sqes = nullptr;
+        return false;
+    }
+    char* base = (char*) rings;
+    sqHead = (unsigned*)( base + params.sq_off.head );
+    sqTail = (unsigned*)( base + params.sq_off.tail );
+    sqFlags = (unsigned*)( base + params.sq_off.flags );
+    sqArray = (unsigned*)( base + params.sq_off.array );
+    sqMask = *(unsigned*)( base + params.sq_off.ring_mask );
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+    //Entry i is always at index i, so the array never changes.
+    for( unsigned i = 0; i < sqEntries; i++ ) sqArray[i] = i;
+    cqHead = (unsigned*)( base + params.cq_off.head );
+    cqTail = (unsigned*)( base + params.cq_off.tail );
+    cqMask = *(unsigned*)( base + params.cq_off.ring_mask );
+    cqes = (io_uring_cqe*)( base + params.cq_off.cqes );
+
+    //The provided buffer ring lives in our memory, it has to be page aligned.
+    void* memory = mmap( nullptr, IO_RING_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( memory == MAP_FAILED ) return false;
+    bufferRing = (io_uring_buf_ring*) memory;
+    io_uring_buf_reg registration = {0};
+    registration.ring_addr = (uint64_t) bufferRing;
+    registration.ring_entries = IO_RING_BUFFERS;
+    registration.bgid = IO_RING_BUFFER_GROUP;
+    if( syscall( __NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1 ) == ERR ) return false;
+    buffers = new char[ (size_t) IO_RING_BUFFERS * IO_RING_BUFFER_SIZE ];
+    for( unsigned id = 0; id < IO_RING_BUFFERS; id++ ) recycle( id );
+
+    //Multishot receives came a release after provided buffer rings and there's no feature flag for them,
+    //so try one on a socket pair. Older kernels fail it with EINVAL.
+    int pair[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair ) == ERR ) return false;
+    receive( pair[0], 0 );
+    bool works = false;
+    errno = 0;
+    if( submit() != ERR && write( pair[1], "?", 1 ) == 1 && Enter( fd, 0, 1, IORING_ENTER_GETEVENTS ) != ERR ){
+        io_uring_cqe* completion = peek();
+        if( completion ){
+            works = ( completion->res == 1 && ( completion->flags & IORING_CQE_F_MORE ) );
+            if( completion->res < 0 ) errno = -completion->res;
+            if( completion->flags & IORING_CQE_F_BUFFER ) recycle( completion->flags >> IORING_CQE_BUFFER_SHIFT );
+            seen();
+        }
+    }
+    //Hanging up ends it, wait for that so nothing's left over.
+    if( works ){
+        shutdown( pair[1], SHUT_WR );
+        Enter( fd, 0, 1, IORING_ENTER_GETEVENTS );
+        while( peek() ) seen();
+    }
+    else if( !errno ) errno = EINVAL;
+    close( pair[0] );
+    close( pair[1] );
+    return works;
+}
+
+io_uring_sqe* IoRing::get(){
+    //Full, make room.
+    if( sqLocalTail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= sqEntries ){
+        submit();
+        if( sqLocalTail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= sqEntries ){
+            Fatal( "io_uring submission queue is stuck : %s", strerror(errno) );
+        }
+    }
+    io_uring_sqe* entry = &sqes[ sqLocalTail & sqMask ];
+    memset( entry, 0, sizeof(*entry) );
+    sqLocalTail++;
+    return entry;
+}
+
+void IoRing::accept( int fd, uint64_t userData ){
+    io_uring_sqe* entry = get();
+    entry->opcode = IORING_OP_ACCEPT;
+    entry->fd = fd;
+    entry->ioprio = IORING_ACCEPT_MULTISHOT;
+    //Left blocking, io_uring never blocks on them and would hand back EAGAIN if they weren't.
+    entry->accept_flags = SOCK_CLOEXEC;
+    entry->user_data = userData;
+}
+
+void IoRing::receive( int fd, uint64_t userData ){
+    io_uring_sqe* entry = get();
+    entry->opcode = IORING_OP_RECV;
+    entry->fd = fd;
+    entry->ioprio = IORING_RECV_MULTISHOT;
+    //The kernel picks a buffer when data arrives, so idle sockets don't hold on to any.
+    entry->flags = IOSQE_BUFFER_SELECT;
+    entry->buf_group = IO_RING_BUFFER_GROUP;
+    entry->user_data = userData;
+}
+
+void IoRing::sendmsg( int fd, const msghdr* header, uint64_t userData ){
+    io_uring_sqe* entry = get();
+    entry->opcode = IORING_OP_SENDMSG;
+    entry->fd = fd;
+    entry->addr = (uint64_t) header;
+    entry->len = 1;
+    entry->msg_flags = MSG_NOSIGNAL;
+    entry->user_data = userData;
+}
+
+int IoRing::submit(){
+    //Let the kernel see what was queued.
+    __atomic_store_n( sqTail, sqLocalTail, __ATOMIC_RELEASE );
+    unsigned queued = sqLocalTail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE );
+    if( !queued ) return 0;
+    int submitted;
+    do{
+        submitted = Enter( fd, queued, 0, 0 );
+    } while( submitted == ERR && errno == EINTR );
+    g_socketStats.submitCalls++;
+    return submitted;
+}
+
+io_uring_cqe* IoRing::peek(){
+    unsigned head = *cqHead;
+    if( head == __atomic_load_n( cqTail, __ATOMIC_ACQUIRE ) ){
+        //The completion queue overflowed at some point, the kernel kept the rest and hands them over on request.
+        if( !( __atomic_load_n( sqFlags, __ATOMIC_RELAXED ) & IORING_SQ_CQ_OVERFLOW ) ) return nullptr;
+        Enter( fd, 0, 0, IORING_ENTER_GETEVENTS );
+        if( head == __atomic_load_n( cqTail, __ATOMIC_ACQUIRE ) ) return nullptr;
+    }
+    return &cqes[ head & cqMask ];
+}
+
+void IoRing::seen(){
+    __atomic_store_n( cqHead, *cqHead + 1, __ATOMIC_RELEASE );
+}
+
+void IoRing::recycle( unsigned id ){
+    //Not bufferRing->bufs, in C++ the header's flexible array comes out a byte off.
+    io_uring_buf* entry = (io_uring_buf*) bufferRing + ( bufferTail & ( IO_RING_BUFFERS - 1 ) );
+    entry->addr = (uint64_t) buffer( id );
+    entry->len = IO_RING_BUFFER_SIZE;
+    entry->bid = id;
+    bufferTail++;
+    __atomic_store_n( &bufferRing->tail, bufferTail, __ATOMIC_RELEASE );
+}
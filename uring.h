@@ -0,0 +1,75 @@
+//Small io_uring instance made with the raw syscalls, so there's no library to install.
+//The server's io_uring backend (--io-uring) uses it so sockets don't need a syscall each: accepts and receives
+//are multishot, meaning they're asked for once and keep completing, received data lands in buffers the kernel
+//picks from a provided buffer ring, and every send queued during a tick goes to the kernel in one io_uring_enter().
+//The ring's file descriptor is readable whenever completions are waiting, so it sits in an event loop like any socket.
+#pragma once
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <cstddef>
+
+//Submission queue entries, the completion queue gets four times as many since multishot requests
+//complete many times for every submission.
+#define IO_RING_ENTRIES 4096
+//Amount of provided buffers and the size of each. Received data is copied out of them right away,
+//so they're only ever in use for a moment.
+#define IO_RING_BUFFERS 256
+#define IO_RING_BUFFER_SIZE 8192
+//Buffer group the provided buffers are registered as.
+#define IO_RING_BUFFER_GROUP 0
+
+class IoRing{
+    public:
+        IoRing() = default;
+        //Unmaps everything and closes the ring.
+        ~IoRing();
+        //The kernel points into it's memory, so no copying.
+        IoRing(const IoRing&) = delete;
+        IoRing& operator=(const IoRing&) = delete;
+
+        //Creates the ring and it's provided buffers, then makes sure the kernel really does multishot receives into them.
+        //Returns false with errno set if something's missing, the caller should stick to epoll then.
+        bool setup();
+        //Queues a multishot accept on a listening socket, it completes once for every connection.
+        void accept( int fd, uint64_t userData );
+        //Queues a multishot receive on a socket into the provided buffers, it completes every time data arrives.
+        void receive( int fd, uint64_t userData );
+        //Queues a sendmsg(), header and everything it points to has to stay put until it completes.
+        void sendmsg( int fd, const msghdr* header, uint64_t userData );
+        //Hands everything queued to the kernel without waiting for any of it, returns -1 on error.
+        int submit();
+        //Oldest completion that wasn't looked at yet, nullptr if there's none. seen() lets go of it.
+        io_uring_cqe* peek();
+        void seen();
+        //Where the kernel put the data of a completion with IORING_CQE_F_BUFFER set.
+        const char* buffer( unsigned id ) const { return buffers + (size_t) id * IO_RING_BUFFER_SIZE; }
+        //Gives a buffer back to the kernel once it's data was copied out.
+        void recycle( unsigned id );
+
+        //Ring file descriptor, readable while there are completions waiting.
+        int fd = -1;
+
+    private:
+        //Next free submission entry, cleared. Submits whatever's queued first if the queue is full.
+        io_uring_sqe* get();
+
+        //Memory shared with the kernel.
+        void* rings = nullptr;
+        size_t ringsSize = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqesSize = 0;
+        //Submission queue, we move the tail and the kernel moves the head.
+        unsigned *sqHead, *sqTail, *sqFlags, *sqArray;
+        unsigned sqMask = 0, sqEntries = 0;
+        //Where our tail is, the kernel only sees it once submit() publishes it.
+        unsigned sqLocalTail = 0;
+        //Completion queue, the kernel moves the tail and we move the head.
+        unsigned *cqHead, *cqTail;
+        unsigned cqMask = 0;
+        io_uring_cqe* cqes = nullptr;
+        //Provided buffer ring, and the memory of the buffers it hands out.
+        io_uring_buf_ring* bufferRing = nullptr;
+        unsigned short bufferTail = 0;
+        char* buffers = nullptr;
+};
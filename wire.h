@@ -0,0 +1,226 @@
+//Describes how packet headers look on the wire.
+//
+//Version 1 (what every client before this spoke):
+//    packetType (1 byte) | padding (1 byte, always 0) | messageSize (2 bytes, big-endian) | nameSize (2 bytes, big-endian)
+//
+//Version 2:
+//    magic (1 byte, 0xC2) | packetType (1 byte) | flags (1 byte) | sequence (varint) | messageSize (varint) | nameSize (varint)
+//
+//Version 3:
+//    magic (1 byte, 0xC3) | packetType (1 byte) | flags (1 byte) | sequence (varint) | member (varint) | messageSize (varint)
+//    | nameSize (varint)
+//
+//All of them are followed by the payload, messageSize bytes of message and then nameSize bytes of name.
+//Varints are unsigned LEB128, 7 bits per byte starting with the lowest ones, the high bit of a byte is set when
+//another byte follows. The magic byte has it's high bit set and no packet type does, so the first byte of a
+//packet tells which version it is and receiving never needs to know what the other end speaks.
+//
+//A client that speaks version 2 says so by putting "2" in the message of it's CONNECT_PACKET (older servers just
+//ignore it), the server answers with a VERSION_PACKET and sends it everything in version 2 from then on.
+//A client sends in version 2 once it got that VERSION_PACKET. Older clients never send the "2", so they keep
+//getting version 1.
+//
+//Version 3 is the same thing with the sender's number. A packet with a number and a name says that's the number's
+//name from now on (CONNECT_PACKETs always have both), after that the server leaves the name out of the packets of
+//someone in the room and the client goes by the number. A JOIN_PACKET forgets every number, the member list and the
+//history after it say them again.
+//
+//Every version is described by a table of fields below, and the same encoder / decoder goes through any of them.
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+//Wire versions.
+#define WIRE_V1 1
+#define WIRE_V2 2
+#define WIRE_V3 3
+//Newest version we speak.
+#define WIRE_VERSION WIRE_V3
+//First byte of every version 2 / version 3 packet.
+#define WIRE_V2_MAGIC 0xC2
+#define WIRE_V3_MAGIC 0xC3
+
+//Biggest message / name we accept in a packet, a bad size shouldn't make us reserve gigabytes.
+#define MAX_PAYLOAD_SIZE (16 * 1024 * 1024)
+//Biggest message / name version 1 can describe.
+#define MAX_V1_PAYLOAD_SIZE 0xFFFF
+
+//Header of the packet, as we use it in memory. What it looks like on the wire depends on the version.
+struct PacketHeader{
+    //What kind of packet is it?
+    uint8_t packetType;
+    //Flags, none are defined yet (version 2 and up).
+    uint8_t flags;
+    //Sequence number of the packet, 0 if it doesn't have one (version 2 and up).
+    uint64_t sequence;
+    //Number of the member the packet is from / about, 0 if it isn't about anyone (version 3 only).
+    uint32_t member;
+    //Size of the message data in the payload.
+    uint32_t messageSize;
+    //Size of the name in the payload.
+    uint32_t nameSize;
+};
+
+//How a field is written on the wire.
+enum WireEncoding{
+    //Constant byte, value holds it.
+    WIRE_MAGIC,
+    //Zero byte that's just there.
+    WIRE_PAD,
+    //Single byte.
+    WIRE_U8,
+    //Two bytes, big-endian.
+    WIRE_BE16,
+    //Unsigned LEB128.
+    WIRE_VARINT
+};
+
+//One field of a header on the wire.
+struct WireField{
+    WireEncoding encoding;
+    //Where the field is in PacketHeader and how big it is there (unused by WIRE_MAGIC and WIRE_PAD).
+    size_t offset, size;
+    //Byte written by WIRE_MAGIC.
+    uint8_t value;
+};
+
+#define WIRE_FIELD( encoding, member ) { encoding, offsetof(PacketHeader, member), sizeof(PacketHeader::member), 0 }
+
+//Version 1 header.
+constexpr WireField c_wireV1[] = {
+    WIRE_FIELD( WIRE_U8, packetType ),
+    { WIRE_PAD, 0, 0, 0 },
+    WIRE_FIELD( WIRE_BE16, messageSize ),
+    WIRE_FIELD( WIRE_BE16, nameSize )
+};
+
+//Version 2 header.
+constexpr WireField c_wireV2[] = {
+    { WIRE_MAGIC, 0, 0, WIRE_V2_MAGIC },
+    WIRE_FIELD( WIRE_U8, packetType ),
+    WIRE_FIELD( WIRE_U8, flags ),
+    WIRE_FIELD( WIRE_VARINT, sequence ),
+    WIRE_FIELD( WIRE_VARINT, messageSize ),
+    WIRE_FIELD( WIRE_VARINT, nameSize )
+};
+
+//Version 3 header.
+constexpr WireField c_wireV3[] = {
+    { WIRE_MAGIC, 0, 0, WIRE_V3_MAGIC },
+    WIRE_FIELD( WIRE_U8, packetType ),
+    WIRE_FIELD( WIRE_U8, flags ),
+    WIRE_FIELD( WIRE_VARINT, sequence ),
+    WIRE_FIELD( WIRE_VARINT, member ),
+    WIRE_FIELD( WIRE_VARINT, messageSize ),
+    WIRE_FIELD( WIRE_VARINT, nameSize )
+};
+
+//Most bytes a header described by fields can take up.
+template<size_t N>
+constexpr size_t MaxHeaderSize( const WireField (&fields)[N] ){
+    size_t size = 0;
+    for( const WireField& field : fields ){
+        if( field.encoding == WIRE_BE16 ) size += 2;
+        //7 bits per byte.
+        else if( field.encoding == WIRE_VARINT ) size += ( field.size * 8 + 6 ) / 7;
+        else size += 1;
+    }
+    return size;
+}
+
+//Most bytes any header can take up.
+#define MAX_HEADER_SIZE std::max( { MaxHeaderSize(c_wireV1), MaxHeaderSize(c_wireV2), MaxHeaderSize(c_wireV3) } )
+
+//Reads field out of header.
+inline uint64_t LoadField( const PacketHeader& header, const WireField& field ){
+    const char* member = (const char*) &header + field.offset;
+    switch( field.size ){
+        case 1: return *(const uint8_t*) member;
+        case 2: return *(const uint16_t*) member;
+        case 4: return *(const uint32_t*) member;
+        default: return *(const uint64_t*) member;
+    }
+}
+
+//Writes value into field of header.
+inline void StoreField( PacketHeader& header, const WireField& field, uint64_t value ){
+    char* member = (char*) &header + field.offset;
+    switch( field.size ){
+        case 1: *(uint8_t*) member = value; break;
+        case 2: *(uint16_t*) member = value; break;
+        case 4: *(uint32_t*) member = value; break;
+        default: *(uint64_t*) member = value; break;
+    }
+}
+
+//Writes header as described by fields into out, which must have room for MaxHeaderSize(fields) bytes.
+//Returns the amount of bytes written.
+template<size_t N>
+inline size_t EncodeHeader( const WireField (&fields)[N], const PacketHeader& header, unsigned char* out ){
+    size_t position = 0;
+    for( const WireField& field : fields ){
+        uint64_t value = ( field.size ) ? LoadField( header, field ) : 0;
+        switch( field.encoding ){
+            case WIRE_MAGIC: out[position++] = field.value; break;
+            case WIRE_PAD:   out[position++] = 0; break;
+            case WIRE_U8:    out[position++] = value; break;
+            case WIRE_BE16:
+                out[position++] = value >> 8;
+                out[position++] = value;
+                break;
+            case WIRE_VARINT:
+                //Lowest 7 bits first, high bit says there's more.
+                while( value >= 0x80 ){
+                    out[position++] = ( value & 0x7F ) | 0x80;
+                    value >>= 7;
+                }
+                out[position++] = value;
+                break;
+        }
+    }
+    return position;
+}
+
+//Reads a header described by fields from the size bytes in data.
+//Returns the size of the header, 0 if data doesn't hold all of it yet or -1 if it's malformed.
+template<size_t N>
+inline int DecodeHeader( const WireField (&fields)[N], const unsigned char* data, size_t size, PacketHeader& header ){
+    size_t position = 0;
+    for( const WireField& field : fields ){
+        if( position >= size ) return 0;
+        switch( field.encoding ){
+            case WIRE_MAGIC:
+                if( data[position++] != field.value ) return -1;
+                break;
+            case WIRE_PAD:
+                position++;
+                break;
+            case WIRE_U8:
+                StoreField( header, field, data[position++] );
+                break;
+            case WIRE_BE16:
+                if( position + 2 > size ) return 0;
+                StoreField( header, field, ( data[position] << 8 ) | data[position + 1] );
+                position += 2;
+                break;
+            case WIRE_VARINT: {
+                uint64_t value = 0;
+                //Most bytes the field can take, anything longer is garbage.
+                size_t maxBytes = ( field.size * 8 + 6 ) / 7;
+                for( size_t i = 0; ; i++ ){
+                    if( i == maxBytes ) return -1;
+                    if( position >= size ) return 0;
+                    uint8_t byte = data[position++];
+                    value |= (uint64_t)( byte & 0x7F ) << ( 7 * i );
+                    if( !( byte & 0x80 ) ) break;
+                }
+                //Doesn't fit in the field.
+                if( field.size < 8 && value >> ( field.size * 8 ) ) return -1;
+                StoreField( header, field, value );
+                break;
+            }
+        }
+    }
+    return position;
+}